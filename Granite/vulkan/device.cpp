@@ -2407,6 +2407,18 @@ void Device::register_time_interval(QueryPoolHandle start_ts, QueryPoolHandle en
 	frame().timestamp_intervals.push_back({ move(start_ts), move(end_ts), timestamp_tag });
 }
 
+void Device::timestamp_log(const TimestampIntervalReportCallback &cb)
+{
+	LOCK();
+	managers.timestamps.log(cb);
+}
+
+void Device::timestamp_log_reset()
+{
+	LOCK();
+	managers.timestamps.reset();
+}
+
 void Device::add_frame_counter()
 {
 	LOCK();
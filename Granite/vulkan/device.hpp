@@ -219,6 +219,11 @@ public:
 	CommandBuffer::Type get_physical_queue_type(CommandBuffer::Type queue_type) const;
 	void register_time_interval(QueryPoolHandle start_ts, QueryPoolHandle end_ts, const char *tag);
 
+	// Reports accumulated time intervals. Intervals are only resolved once their frame context completes,
+	// so call wait_idle() first to include all submitted work.
+	void timestamp_log(const TimestampIntervalReportCallback &cb);
+	void timestamp_log_reset();
+
 	// Request shaders and programs. These objects are owned by the Device.
 	Shader *request_shader(const uint32_t *code, size_t size);
 	Shader *request_shader_by_hash(Util::Hash hash);
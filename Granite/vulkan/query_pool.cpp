@@ -428,6 +428,13 @@ double TimestampInterval::get_total_time() const
 	return total_time;
 }
 
+void TimestampInterval::reset()
+{
+	total_time = 0.0;
+	total_accumulations = 0;
+	total_frame_iterations = 0;
+}
+
 void TimestampInterval::accumulate_time(double t)
 {
 	total_time += t;
@@ -478,4 +485,30 @@ void TimestampIntervalManager::log_simple()
 		}
 	}
 }
-}
\ No newline at end of file
+
+void TimestampIntervalManager::log(const TimestampIntervalReportCallback &cb)
+{
+	for (auto &timestamp : timestamps)
+	{
+		TimestampIntervalReport report = {};
+		report.total_time = timestamp.get_total_time();
+		report.total_accumulations = timestamp.get_total_accumulations();
+		report.total_frame_iterations = timestamp.get_total_frame_iterations();
+		report.time_per_frame_context = timestamp.get_time_per_iteration();
+		if (report.total_accumulations)
+			report.time_per_accumulation = report.total_time / double(report.total_accumulations);
+		if (report.total_frame_iterations)
+		{
+			report.accumulations_per_frame_context =
+					double(report.total_accumulations) / double(report.total_frame_iterations);
+		}
+		cb(timestamp.get_tag(), report);
+	}
+}
+
+void TimestampIntervalManager::reset()
+{
+	for (auto &timestamp : timestamps)
+		timestamp.reset();
+}
+}
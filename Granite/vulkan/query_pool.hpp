@@ -25,6 +25,8 @@
 #include "vulkan_headers.hpp"
 #include "vulkan_common.hpp"
 #include "object_pool.hpp"
+#include <functional>
+#include <string>
 
 namespace Vulkan
 {
@@ -142,6 +144,7 @@ public:
 	double get_total_time() const;
 	uint64_t get_total_frame_iterations() const;
 	uint64_t get_total_accumulations() const;
+	void reset();
 
 private:
 	std::string tag;
@@ -150,6 +153,17 @@ private:
 	uint64_t total_accumulations = 0;
 };
 
+struct TimestampIntervalReport
+{
+	double total_time;
+	double time_per_accumulation;
+	double time_per_frame_context;
+	double accumulations_per_frame_context;
+	uint64_t total_accumulations;
+	uint64_t total_frame_iterations;
+};
+using TimestampIntervalReportCallback = std::function<void (const std::string &, const TimestampIntervalReport &)>;
+
 class TimestampIntervalManager
 {
 public:
@@ -157,6 +171,8 @@ public:
 	void mark_end_of_frame_context();
 
 	void log_simple();
+	void log(const TimestampIntervalReportCallback &cb);
+	void reset();
 
 private:
 	Util::IntrusiveHashMap<TimestampInterval> timestamps;
@@ -84,6 +84,7 @@ struct n64video_config
     } vi;
     struct {
         enum dp_compat_profile compat;  // multithreading compatibility mode
+        uint32_t band_lines;            // scanlines per worker band, 0 or 1 interleaves single scanlines
     } dp;
     bool parallel;                  // use multithreaded renderer if true
     uint32_t num_workers;           // number of rendering workers
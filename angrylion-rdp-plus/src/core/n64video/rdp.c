@@ -191,6 +191,7 @@ struct rdp_state
 {
     uint32_t stride;
     uint32_t offset;
+    uint32_t band_lines;
 
     int blshifta;
     int blshiftb;
@@ -567,6 +568,7 @@ void rdp_init(uint32_t wid, uint32_t num_workers)
 {
     state[wid].stride = num_workers;
     state[wid].offset = wid;
+    state[wid].band_lines = config.dp.band_lines ? config.dp.band_lines : 1;
     state[wid].rseed = 3 + wid * 13;
 
     uint32_t tmp[2] = { 0 };
@@ -1859,6 +1859,28 @@ static void render_spans_copy(uint32_t wid, int start, int end, int tilenum, int
     }
 }
 
+static STRICTINLINE int line_owned(uint32_t wid, int32_t line)
+{
+    return !state[wid].stride || (line / state[wid].band_lines) % state[wid].stride == state[wid].offset;
+}
+
+// returns false only if none of the scanlines from first to last belong to this worker
+static int lines_overlap_worker(uint32_t wid, int32_t first, int32_t last)
+{
+    if (!state[wid].stride || last < first)
+        return 1;
+
+    int32_t band_first = first / state[wid].band_lines;
+    int32_t band_last = last / state[wid].band_lines;
+    if (band_last - band_first + 1 >= (int32_t)state[wid].stride)
+        return 1;
+
+    for (int32_t band = band_first; band <= band_last; band++)
+        if (band % state[wid].stride == state[wid].offset)
+            return 1;
+    return 0;
+}
+
 static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
 {
     int j = 0;
@@ -2125,6 +2147,15 @@ static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
 
     int yhclose = yhlimit & ~3;
 
+    // with banded work split, skip the edge walk entirely if the primitive
+    // only covers other workers' scanlines, but keep the primitive count in
+    // sync since it seeds the noise generator
+    if (!lines_overlap_worker(wid, yhlimit >> 2, yllimit >> 2))
+    {
+        state[wid].primitive_count++;
+        return;
+    }
+
     int32_t clipxlshift = state[wid].clip.xl << 1;
     int32_t clipxhshift = state[wid].clip.xh << 1;
     int allover = 1, allunder = 1, curover = 0, curunder = 0;
@@ -2214,7 +2245,7 @@ static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
             {
                 state[wid].span[j].lx = maxxmx;
                 state[wid].span[j].rx = minxhx;
-                state[wid].span[j].validline  = !allinval && !allover && !allunder && (!state[wid].scfield || (state[wid].scfield && !(state[wid].sckeepodd ^ (j & 1)))) && (!state[wid].stride || j % state[wid].stride == state[wid].offset);
+                state[wid].span[j].validline  = !allinval && !allover && !allunder && (!state[wid].scfield || (state[wid].scfield && !(state[wid].sckeepodd ^ (j & 1)))) && line_owned(wid, j);
 
                 /* Workaround game bugs in validation which mistakenly render past their scanline. */
                 if (state[wid].span[j].lx >= state[wid].fb_width)
@@ -2306,7 +2337,7 @@ static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
             {
                 state[wid].span[j].lx = minxmx;
                 state[wid].span[j].rx = maxxhx;
-                state[wid].span[j].validline  = !allinval && !allover && !allunder && (!state[wid].scfield || (state[wid].scfield && !(state[wid].sckeepodd ^ (j & 1)))) && (!state[wid].stride || j % state[wid].stride == state[wid].offset);
+                state[wid].span[j].validline  = !allinval && !allover && !allunder && (!state[wid].scfield || (state[wid].scfield && !(state[wid].sckeepodd ^ (j & 1)))) && line_owned(wid, j);
 
                 /* Workaround game bugs in validation which mistakenly render past their scanline. */
                 if (state[wid].span[j].lx >= state[wid].fb_width)
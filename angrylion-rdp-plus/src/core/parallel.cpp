@@ -5,14 +5,209 @@
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
-class Parallel
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+class ParallelBase
+{
+public:
+    virtual ~ParallelBase() = default;
+    virtual void run(void task(std::uint32_t)) = 0;
+    virtual std::uint32_t num_workers() = 0;
+};
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif (defined(__aarch64__) || defined(__arm__)) && (defined(__GNUC__) || defined(__clang__))
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Dispatches tasks through a generation counter. Workers and the main thread spin on atomics
+// for a while before parking on a condition variable, so back-to-back tasks never touch a mutex.
+// Every worker reports completion through its own cache line, so workers never contend with each other.
+class Parallel : public ParallelBase
 {
 public:
     Parallel(std::uint32_t num_workers)
+    {
+        if (num_workers == 0) {
+            // auto-select number of workers based on the number of cores
+            m_num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+        } else {
+            m_num_workers = std::min(num_workers, PARALLEL_MAX_WORKERS);
+        }
+
+        // spinning only pays off if every worker has a core to itself
+        unsigned num_cores = std::thread::hardware_concurrency();
+        m_spin_count = num_cores == 0 || m_num_workers <= num_cores ? SPIN_COUNT : 0;
+
+        m_worker_states = std::vector<WorkerState>(m_num_workers);
+
+        // create worker threads, worker 0 runs in the main thread
+        for (std::uint32_t worker_id = 1; worker_id < m_num_workers; worker_id++) {
+            m_workers.emplace_back(std::thread(&Parallel::do_work, this, worker_id));
+        }
+    }
+
+    ~Parallel() override {
+        // exit worker main loops
+        m_accept_work = false;
+        start_work();
+
+        // join worker threads to make sure they have finished
+        for (auto& thread : m_workers) {
+            thread.join();
+        }
+    }
+
+    void run(void task(std::uint32_t)) override {
+        // don't allow more tasks if workers are stopping
+        if (!m_accept_work) {
+            throw std::runtime_error("Workers are exiting and no longer accept work");
+        }
+
+        // prepare task for workers and send signal so they start working
+        m_task = task;
+        std::uint32_t generation = start_work();
+
+        // run worker 0 directly on main thread
+        m_task(0);
+
+        // wait for all workers to finish
+        wait(generation);
+    }
+
+    std::uint32_t num_workers() override {
+        return m_num_workers;
+    }
+
+private:
+    // Number of polls before a thread parks itself.
+    static constexpr std::uint32_t SPIN_COUNT = 1 << 14;
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+    struct WorkerState
+    {
+        std::atomic<std::uint32_t> done_generation { 0 };
+        char padding[CACHE_LINE_SIZE - sizeof(std::atomic<std::uint32_t>)];
+    };
+
+    void (*m_task)(std::uint32_t) = nullptr;
+    std::vector<std::thread> m_workers;
+    std::vector<WorkerState> m_worker_states;
+    std::uint32_t m_num_workers;
+    std::uint32_t m_spin_count;
+    std::atomic<bool> m_accept_work { true };
+
+    // Written by the main thread only. Padded rather than aligned, since over-aligned new needs C++17.
+    char m_padding0[CACHE_LINE_SIZE];
+    std::atomic<std::uint32_t> m_generation { 0 };
+    char m_padding1[CACHE_LINE_SIZE];
+
+    // Only used once a thread gives up spinning.
+    std::mutex m_park_mutex;
+    std::condition_variable m_signal_work;
+    std::condition_variable m_signal_done;
+    std::atomic<std::uint32_t> m_parked_workers { 0 };
+    std::atomic<bool> m_main_parked { false };
+
+    std::uint32_t start_work() {
+        // m_task is published by this store
+        std::uint32_t generation = m_generation.fetch_add(1) + 1;
+
+        // only take the lock if a worker might be sleeping, the seq_cst ordering of
+        // m_generation and m_parked_workers guarantees that we see the worker otherwise
+        if (m_parked_workers.load() != 0) {
+            std::lock_guard<std::mutex> lock(m_park_mutex);
+            m_signal_work.notify_all();
+        }
+
+        return generation;
+    }
+
+    void do_work(std::uint32_t worker_id) {
+        auto& state = m_worker_states[worker_id];
+        std::uint32_t generation = 0;
+
+        for (;;) {
+            // wait for the next task
+            std::uint32_t count = 0;
+            while (m_generation.load() == generation && count++ < m_spin_count) {
+                cpu_relax();
+            }
+
+            if (m_generation.load() == generation) {
+                std::unique_lock<std::mutex> ul(m_park_mutex);
+                m_parked_workers.fetch_add(1);
+                m_signal_work.wait(ul, [generation, this] {
+                    return m_generation.load() != generation;
+                });
+                m_parked_workers.fetch_sub(1);
+            }
+
+            generation = m_generation.load();
+            if (!m_accept_work) {
+                break;
+            }
+
+            // do the work
+            m_task(worker_id);
+
+            // mark task as done and notify main thread if it went to sleep
+            state.done_generation.store(generation);
+            if (m_main_parked.load()) {
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+                m_signal_done.notify_one();
+            }
+        }
+    }
+
+    bool all_done(std::uint32_t generation) {
+        for (std::uint32_t i = 1; i < m_num_workers; i++) {
+            if (m_worker_states[i].done_generation.load() != generation) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void wait(std::uint32_t generation) {
+        std::uint32_t count = 0;
+        while (!all_done(generation) && count++ < m_spin_count) {
+            cpu_relax();
+        }
+
+        if (!all_done(generation)) {
+            std::unique_lock<std::mutex> ul(m_park_mutex);
+            m_main_parked = true;
+            m_signal_done.wait(ul, [generation, this] {
+                return all_done(generation);
+            });
+            m_main_parked = false;
+        }
+    }
+
+    void operator=(const Parallel&) = delete;
+    Parallel(const Parallel&) = delete;
+};
+
+// The original implementation, where workers always sleep on a condition variable between tasks.
+class ParallelCondVar : public ParallelBase
+{
+public:
+    ParallelCondVar(std::uint32_t num_workers)
     {
         if (num_workers == 0) {
             // auto-select number of workers based on the number of cores
@@ -32,14 +227,14 @@ public:
 
         // create worker threads
         for (std::uint32_t worker_id = 1; worker_id < m_num_workers; worker_id++) {
-            m_workers.emplace_back(std::thread(&Parallel::do_work, this, worker_id));
+            m_workers.emplace_back(std::thread(&ParallelCondVar::do_work, this, worker_id));
         }
 
         // synchronize workers to prepare them for real tasks
         wait();
     }
 
-    ~Parallel() {
+    ~ParallelCondVar() override {
         // wait for all workers to finish their current work
         wait();
 
@@ -56,7 +251,7 @@ public:
         m_workers.clear();
     }
 
-    void run(std::function<void(std::uint32_t)>&& task) {
+    void run(void task(std::uint32_t)) override {
         // don't allow more tasks if workers are stopping
         if (!m_accept_work) {
             throw std::runtime_error("Workers are exiting and no longer accept work");
@@ -73,7 +268,7 @@ public:
         wait();
     }
 
-    std::uint32_t num_workers() {
+    std::uint32_t num_workers() override {
         return m_num_workers;
     }
 
@@ -159,16 +354,25 @@ private:
         });
     }
 
-    void operator=(const Parallel&) = delete;
-    Parallel(const Parallel&) = delete;
+    void operator=(const ParallelCondVar&) = delete;
+    ParallelCondVar(const ParallelCondVar&) = delete;
 };
 
 // C interface for the Parallel class
-static std::unique_ptr<Parallel> parallel;
+static std::unique_ptr<ParallelBase> parallel;
 
 void parallel_init(uint32_t num)
 {
-    parallel = std::make_unique<Parallel>(num);
+    parallel_init_dispatch(num, PARALLEL_DISPATCH_SPIN_PARK);
+}
+
+void parallel_init_dispatch(uint32_t num, enum parallel_dispatch dispatch)
+{
+    if (dispatch == PARALLEL_DISPATCH_CONDVAR) {
+        parallel = std::make_unique<ParallelCondVar>(num);
+    } else {
+        parallel = std::make_unique<Parallel>(num);
+    }
 }
 
 void parallel_run(void task(uint32_t))
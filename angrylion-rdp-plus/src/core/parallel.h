@@ -8,7 +8,16 @@ extern "C" {
 
 #define PARALLEL_MAX_WORKERS 64u
 
+enum parallel_dispatch
+{
+    // workers spin for a while before sleeping, so back-to-back tasks are dispatched without locking
+    PARALLEL_DISPATCH_SPIN_PARK,
+    // workers always sleep on a condition variable between tasks
+    PARALLEL_DISPATCH_CONDVAR
+};
+
 void parallel_init(uint32_t num);
+void parallel_init_dispatch(uint32_t num, enum parallel_dispatch dispatch);
 void parallel_run(void task(uint32_t));
 uint32_t parallel_num_workers();
 void parallel_close();
@@ -0,0 +1,130 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "parallel.h"
+#include "cli_parser.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <thread>
+
+// Measures the cost of dispatching tasks to Angrylion's worker pool,
+// which happens for every batch of buffered commands, and for every VI scanout.
+
+static unsigned work_per_task;
+
+struct WorkerSink
+{
+	uint32_t value;
+	char padding[60];
+};
+static WorkerSink sinks[PARALLEL_MAX_WORKERS];
+
+static void task(uint32_t worker_id)
+{
+	// Stand-in for a small command batch.
+	uint32_t value = sinks[worker_id].value;
+	for (unsigned i = 0; i < work_per_task; i++)
+		value = value * 1664525u + 1013904223u;
+	sinks[worker_id].value = value;
+}
+
+static const char *dispatch_name(parallel_dispatch dispatch)
+{
+	return dispatch == PARALLEL_DISPATCH_CONDVAR ? "condvar" : "spin-park";
+}
+
+static void run_benchmark(parallel_dispatch dispatch, unsigned num_workers, unsigned iterations)
+{
+	parallel_init_dispatch(num_workers, dispatch);
+
+	// Warm up, so threads are running.
+	for (unsigned i = 0; i < 100; i++)
+		parallel_run(task);
+
+	auto start_time = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+		parallel_run(task);
+	auto end_time = Util::get_current_time_nsecs();
+
+	double usec = double(end_time - start_time) * 1e-3;
+	LOGI("%10s, %2u workers: %.3f us / dispatch.\n",
+	     dispatch_name(dispatch), parallel_num_workers(), usec / double(iterations));
+
+	parallel_close();
+}
+
+static void print_help()
+{
+	LOGE("Usage: angrylion-parallel-bench\n"
+	     "\t[--iterations <count>]\n"
+	     "\t[--work <iterations per task>]\n"
+	     "\t[--workers <max count>]\n"
+	);
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	unsigned iterations = 100000;
+	unsigned max_workers = std::thread::hardware_concurrency();
+	work_per_task = 1000;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--iterations", [&](Util::CLIParser &parser) { iterations = parser.next_uint(); });
+	cbs.add("--work", [&](Util::CLIParser &parser) { work_per_task = parser.next_uint(); });
+	cbs.add("--workers", [&](Util::CLIParser &parser) { max_workers = parser.next_uint(); });
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (max_workers == 0)
+		max_workers = 1;
+	if (max_workers > PARALLEL_MAX_WORKERS)
+		max_workers = PARALLEL_MAX_WORKERS;
+
+	for (unsigned num_workers = 1; ; num_workers *= 2)
+	{
+		num_workers = std::min(num_workers, max_workers);
+		run_benchmark(PARALLEL_DISPATCH_CONDVAR, num_workers, iterations);
+		run_benchmark(PARALLEL_DISPATCH_SPIN_PARK, num_workers, iterations);
+		if (num_workers == max_workers)
+			break;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
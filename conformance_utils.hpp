@@ -23,6 +23,7 @@
 #pragma once
 
 #include <random>
+#include <algorithm>
 #include "logging.hpp"
 #include "context.hpp"
 #include "device.hpp"
@@ -70,15 +71,86 @@ struct Interface : ReplayerEventInterface
 
 	bool is_eof = false;
 
-	struct
+	// Framebuffer state and written RDRAM ranges are tracked per context,
+	// since with a threaded side-by-side driver, the reference context lags behind the GPU context.
+	struct FramebufferState
 	{
 		uint32_t addr = 0;
 		uint32_t size = 0;
 		uint32_t width = 0;
 		uint32_t depth_addr = 0;
-	} fb;
+		// Scissor in 10.2 fixed point. Conservative until a scissor is set.
+		uint32_t scissor_ylo = 0;
+		uint32_t scissor_yhi = 0xfff;
+		bool depth_update = false;
+	};
+	FramebufferState fb_for_context[2];
+
+	// RDRAM ranges which draw calls may have written to since last cleared.
+	// Ranges cover the framebuffer rows touched by each primitive's vertical extent within the scissor.
+	// If too many distinct ranges are written, all_rdram_written is set instead.
+	struct RDRAMRange
+	{
+		size_t offset;
+		size_t size;
+	};
+	enum { MaxWrittenRDRAMRanges = 64 };
+	std::vector<RDRAMRange> written_rdram_ranges_for_context[2];
+	bool all_rdram_written_for_context[2] = {};
+
+	inline void add_written_rdram_range(unsigned context, size_t offset, size_t size);
+	inline void clear_written_rdram_ranges();
+	inline void reset_counters();
 };
 
+void Interface::reset_counters()
+{
+	for (unsigned i = 0; i < 2; i++)
+	{
+		draw_calls_for_context[i] = 0;
+		frame_count_for_context[i] = 0;
+		syncs_for_context[i] = 0;
+	}
+	is_eof = false;
+}
+
+void Interface::add_written_rdram_range(unsigned context, size_t offset, size_t size)
+{
+	if (all_rdram_written_for_context[context])
+		return;
+
+	auto &ranges = written_rdram_ranges_for_context[context];
+
+	// Consecutive primitives tend to touch overlapping or adjacent rows, so grow existing ranges.
+	for (auto &range : ranges)
+	{
+		if (offset <= range.offset + range.size && range.offset <= offset + size)
+		{
+			size_t end = std::max(range.offset + range.size, offset + size);
+			range.offset = std::min(range.offset, offset);
+			range.size = end - range.offset;
+			return;
+		}
+	}
+
+	if (ranges.size() >= MaxWrittenRDRAMRanges)
+	{
+		ranges.clear();
+		all_rdram_written_for_context[context] = true;
+	}
+	else
+		ranges.push_back({ offset, size });
+}
+
+void Interface::clear_written_rdram_ranges()
+{
+	for (unsigned i = 0; i < 2; i++)
+	{
+		written_rdram_ranges_for_context[i].clear();
+		all_rdram_written_for_context[i] = false;
+	}
+}
+
 void Interface::update_screen(const void *data, unsigned width, unsigned height, unsigned pitch)
 {
 	scanout_result[current_context].resize(width * height);
@@ -102,9 +174,37 @@ void Interface::set_context_index(unsigned index)
 
 void Interface::notify_command(Op cmd_id, uint32_t, const uint32_t *words)
 {
+	auto &fb = fb_for_context[current_context];
+
 	if (command_is_draw_call(cmd_id))
 	{
 		draw_calls_for_context[current_context]++;
+
+		// Vertical extent in 10.2 fixed point.
+		int yh, yl;
+		if (cmd_id == Op::TextureRectangle || cmd_id == Op::TextureRectangleFlip || cmd_id == Op::FillRectangle)
+		{
+			yl = int(words[0] & 0xfff);
+			yh = int(words[1] & 0xfff);
+		}
+		else
+		{
+			yl = int32_t(words[0] << 18) >> 18;
+			yh = int32_t(words[1] << 18) >> 18;
+		}
+
+		int y_begin = std::max(yh, int(fb.scissor_ylo)) >> 2;
+		int y_end = (std::min(yl, int(fb.scissor_yhi)) + 3) >> 2;
+		if (y_end >= y_begin)
+		{
+			// 4-bit framebuffers are rounded up to one byte per pixel.
+			size_t bytes_per_pixel = fb.size == 3 ? 4 : (fb.size == 2 ? 2 : 1);
+			size_t rows = size_t(y_end - y_begin + 1);
+			add_written_rdram_range(current_context, fb.addr + y_begin * fb.width * bytes_per_pixel,
+			                        rows * fb.width * bytes_per_pixel);
+			if (fb.depth_update)
+				add_written_rdram_range(current_context, fb.depth_addr + y_begin * fb.width * 2, rows * fb.width * 2);
+		}
 	}
 	else if (cmd_id == Op::SetColorImage)
 	{
@@ -116,6 +216,15 @@ void Interface::notify_command(Op cmd_id, uint32_t, const uint32_t *words)
 	{
 		fb.depth_addr = words[1] & 0xffffff;
 	}
+	else if (cmd_id == Op::SetScissor)
+	{
+		fb.scissor_ylo = words[0] & 0xfff;
+		fb.scissor_yhi = words[1] & 0xfff;
+	}
+	else if (cmd_id == Op::SetOtherModes)
+	{
+		fb.depth_update = (words[1] & (1 << 5)) != 0;
+	}
 }
 
 void Interface::signal_complete()
@@ -127,14 +236,20 @@ struct ReplayerState
 {
 	~ReplayerState()
 	{
+		// Drain the worker thread before tearing down the drivers it feeds.
+		combined.reset();
 		// Ensure that debug callbacks are flushed.
 		device.wait_idle();
 	}
 
 	inline bool init();
-	inline bool init(DumpPlayer &dump);
+	// With threaded, the reference driver runs on a worker thread and is only synchronized with
+	// in combined->idle() and end_frame(). The reference state must not be inspected before that.
+	inline bool init(DumpPlayer &dump, bool threaded = false);
 	Vulkan::Context context;
 	Vulkan::Device device;
+	std::mutex iface_lock;
+	std::unique_ptr<ReplayerEventInterface> reference_iface, gpu_iface;
 	std::unique_ptr<ReplayerDriver> reference, gpu;
 	std::unique_ptr<ReplayerDriver> combined;
 	CommandBuilder builder;
@@ -173,87 +288,163 @@ bool ReplayerState::init()
 	return true;
 }
 
-bool ReplayerState::init(DumpPlayer &dump)
+bool ReplayerState::init(DumpPlayer &dump, bool threaded)
 {
 	if (!init_common())
 		return false;
 
-	reference = create_replayer_driver_angrylion(dump, iface);
-	gpu = create_replayer_driver_parallel(device, dump, iface);
-	combined = create_side_by_side_driver(reference.get(), gpu.get(), iface);
+	if (threaded)
+	{
+		reference_iface = create_synchronized_event_interface(iface, 0, iface_lock);
+		gpu_iface = create_synchronized_event_interface(iface, 1, iface_lock);
+		reference = create_replayer_driver_angrylion(dump, *reference_iface);
+		gpu = create_replayer_driver_parallel(device, dump, *gpu_iface);
+		combined = create_threaded_side_by_side_driver(reference.get(), gpu.get());
+	}
+	else
+	{
+		reference = create_replayer_driver_angrylion(dump, iface);
+		gpu = create_replayer_driver_parallel(device, dump, iface);
+		combined = create_side_by_side_driver(reference.get(), gpu.get(), iface);
+	}
 	dump.set_command_interface(combined.get());
 	return true;
 }
 
-static inline bool compare_memory(const char *tag, const uint8_t *reference_, const uint8_t *gpu_, size_t size,
-                                  uint32_t *fault_addr)
+// Returns the offset of the first differing 16 byte block, or size if the buffers are equal.
+// memcmp is vectorized by the C library, so narrow down with large blocks before looking at individual bytes.
+static inline size_t find_first_memory_delta(const uint8_t *reference, const uint8_t *gpu, size_t size)
 {
-	if (!memcmp(reference_, gpu_, size))
-	{
-		auto *reference = reinterpret_cast<const uint32_t *>(reference_);
-		size /= sizeof(uint32_t);
+	constexpr size_t CoarseBlockSize = 4096;
+	constexpr size_t FineBlockSize = 16;
 
-		bool nonzero = false;
-		for (size_t i = 0; i < size; i++)
-		{
-			if (reference[i] != 0)
-			{
-				nonzero = true;
-				break;
-			}
-		}
-		if (!nonzero)
-			LOGW("RDRAM is completely zero, might not be a valuable test.\n");
-		return true;
+	size_t offset = 0;
+	while (offset < size)
+	{
+		size_t block_size = std::min(CoarseBlockSize, size - offset);
+		if (memcmp(reference + offset, gpu + offset, block_size) != 0)
+			break;
+		offset += block_size;
 	}
-	else
+
+	if (offset >= size)
+		return size;
+
+	size_t end = std::min(offset + CoarseBlockSize, size);
+	while (offset < end)
 	{
-		auto *reference = reference_;
-		auto *reference16 = reinterpret_cast<const uint16_t *>(reference_);
-		auto *reference32 = reinterpret_cast<const uint32_t *>(reference_);
-		auto *gpu = gpu_;
-		auto *gpu16 = reinterpret_cast<const uint16_t *>(gpu_);
-		auto *gpu32 = reinterpret_cast<const uint32_t *>(gpu_);
+		size_t block_size = std::min(FineBlockSize, end - offset);
+		if (memcmp(reference + offset, gpu + offset, block_size) != 0)
+			break;
+		offset += block_size;
+	}
 
-		bool nonzero = false;
-		for (size_t i = 0; i < size; i++)
-		{
-			if (reference[i ^ 3] != gpu[i ^ 3])
-			{
-				LOGE("  8-bit coord: (%d, %d)\n", int(i % 320), int(i / 320));
-				LOGE("Memory delta found at byte %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i, tag, reference[i ^ 3],
-				     gpu[i ^ 3]);
+	return offset;
+}
 
-				LOGE("  16-bit coord: (%d, %d)\n", int((i >> 1) % 320), int((i >> 1) / 320));
-				LOGE("Memory delta found at word %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i >> 1, tag, reference16[(i >> 1) ^ 1],
-				     gpu16[(i >> 1) ^ 1]);
+static inline bool memory_is_zero(const uint8_t *data, size_t size)
+{
+	// If the first byte is zero and every byte equals its successor, everything is zero.
+	return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
 
-				LOGE("  32-bit coord: (%d, %d)\n", int((i >> 2) % 320), int((i >> 2) / 320));
-				LOGE("Memory delta found at dword %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i >> 2, tag, reference32[i >> 2],
-				     gpu32[i >> 2]);
+// Logs the first differing byte in the differing 16 byte block at offset block.
+static inline void report_memory_delta(const char *tag, const uint8_t *reference_, const uint8_t *gpu_, size_t size,
+                                       size_t block, uint32_t *fault_addr)
+{
+	auto *reference = reference_;
+	auto *reference16 = reinterpret_cast<const uint16_t *>(reference_);
+	auto *reference32 = reinterpret_cast<const uint32_t *>(reference_);
+	auto *gpu = gpu_;
+	auto *gpu16 = reinterpret_cast<const uint16_t *>(gpu_);
+	auto *gpu32 = reinterpret_cast<const uint32_t *>(gpu_);
+
+	if (fault_addr)
+		*fault_addr = uint32_t(block);
+
+	// Byte swizzling stays within an aligned 16 byte block.
+	size_t end = std::min(block + 16, size);
+	for (size_t i = block; i < end; i++)
+	{
+		if (reference[i ^ 3] != gpu[i ^ 3])
+		{
+			LOGE("  8-bit coord: (%d, %d)\n", int(i % 320), int(i / 320));
+			LOGE("Memory delta found at byte %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i, tag, reference[i ^ 3],
+			     gpu[i ^ 3]);
 
-				if (fault_addr)
-					*fault_addr = i;
-				return false;
-			}
+			LOGE("  16-bit coord: (%d, %d)\n", int((i >> 1) % 320), int((i >> 1) / 320));
+			LOGE("Memory delta found at word %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i >> 1, tag, reference16[(i >> 1) ^ 1],
+			     gpu16[(i >> 1) ^ 1]);
 
-			if (reference[i ^ 3] != 0)
-				nonzero = true;
+			LOGE("  32-bit coord: (%d, %d)\n", int((i >> 2) % 320), int((i >> 2) / 320));
+			LOGE("Memory delta found at dword %zu for %s, (ref) 0x%02x != (gpu) 0x%02x!\n", i >> 2, tag, reference32[i >> 2],
+			     gpu32[i >> 2]);
+
+			if (fault_addr)
+				*fault_addr = uint32_t(i);
+			return;
 		}
+	}
+}
 
+// known_nonzero caches the result of the all-zero check, which only serves to warn about useless tests.
+// Once the reference has been observed to be non-zero, the check is skipped.
+static inline bool compare_memory(const char *tag, const uint8_t *reference, const uint8_t *gpu, size_t size,
+                                  uint32_t *fault_addr, bool *known_nonzero = nullptr)
+{
+	size_t block = find_first_memory_delta(reference, gpu, size);
+	if (block < size)
+	{
+		report_memory_delta(tag, reference, gpu, size, block, fault_addr);
+		return false;
+	}
+
+	if (!known_nonzero || !*known_nonzero)
+	{
+		bool nonzero = !memory_is_zero(reference, size);
 		if (!nonzero)
-			LOGW("RDRAM is completely zero, might not be a valuable test.\n");
+			LOGW("%s is completely zero, might not be a valuable test.\n", tag);
+		if (known_nonzero)
+			*known_nonzero = nonzero;
+	}
+
+	return true;
+}
+
+// Compares [offset, offset + range_size) of two buffers of size bytes.
+static inline bool compare_memory_range(const char *tag, const uint8_t *reference, const uint8_t *gpu, size_t size,
+                                        size_t offset, size_t range_size, uint32_t *fault_addr)
+{
+	// Keep 16 byte alignment so byte swizzling stays within the compared range.
+	size_t begin = offset & ~size_t(15);
+	size_t end = std::min((offset + range_size + 15) & ~size_t(15), size);
+	if (begin >= end)
+		return true;
+
+	size_t block = begin + find_first_memory_delta(reference + begin, gpu + begin, end - begin);
+	if (block < end)
+	{
+		report_memory_delta(tag, reference, gpu, size, block, fault_addr);
+		return false;
 	}
 
 	return true;
 }
 
+struct RDRAMCompareState
+{
+	bool rdram_nonzero = false;
+	bool hidden_rdram_nonzero = false;
+};
+
 static inline bool compare_rdram(ReplayerDriver &reference, ReplayerDriver &gpu,
-                                 uint32_t *fault_addr = nullptr, bool *fault_hidden = nullptr)
+                                 uint32_t *fault_addr = nullptr, bool *fault_hidden = nullptr,
+                                 RDRAMCompareState *compare_state = nullptr)
 {
 	auto *rdram_reference = reference.get_rdram();
 	auto *rdram_gpu = gpu.get_rdram();
-	if (!compare_memory("RDRAM", rdram_reference, rdram_gpu, gpu.get_rdram_size(), fault_addr))
+	if (!compare_memory("RDRAM", rdram_reference, rdram_gpu, gpu.get_rdram_size(), fault_addr,
+	                    compare_state ? &compare_state->rdram_nonzero : nullptr))
 	{
 		if (fault_hidden)
 			*fault_hidden = false;
@@ -262,7 +453,8 @@ static inline bool compare_rdram(ReplayerDriver &reference, ReplayerDriver &gpu,
 
 	auto *hidden_reference = reference.get_hidden_rdram();
 	auto *hidden_gpu = gpu.get_hidden_rdram();
-	if (!compare_memory("Hidden RDRAM", hidden_reference, hidden_gpu, gpu.get_hidden_rdram_size(), fault_addr))
+	if (!compare_memory("Hidden RDRAM", hidden_reference, hidden_gpu, gpu.get_hidden_rdram_size(), fault_addr,
+	                    compare_state ? &compare_state->hidden_rdram_nonzero : nullptr))
 	{
 		if (fault_hidden)
 			*fault_hidden = true;
@@ -272,6 +464,41 @@ static inline bool compare_rdram(ReplayerDriver &reference, ReplayerDriver &gpu,
 	return true;
 }
 
+// Only compares the RDRAM ranges which may have been written by the RDP, as tracked by Interface.
+// Hidden RDRAM has one byte for every two bytes of RDRAM.
+static inline bool compare_rdram_ranges(ReplayerDriver &reference, ReplayerDriver &gpu,
+                                        const std::vector<Interface::RDRAMRange> &ranges,
+                                        uint32_t *fault_addr = nullptr, bool *fault_hidden = nullptr)
+{
+	auto *rdram_reference = reference.get_rdram();
+	auto *rdram_gpu = gpu.get_rdram();
+	size_t rdram_size = gpu.get_rdram_size();
+	auto *hidden_reference = reference.get_hidden_rdram();
+	auto *hidden_gpu = gpu.get_hidden_rdram();
+	size_t hidden_size = gpu.get_hidden_rdram_size();
+
+	for (auto &range : ranges)
+	{
+		if (!compare_memory_range("RDRAM", rdram_reference, rdram_gpu, rdram_size,
+		                          range.offset, range.size, fault_addr))
+		{
+			if (fault_hidden)
+				*fault_hidden = false;
+			return false;
+		}
+
+		if (!compare_memory_range("Hidden RDRAM", hidden_reference, hidden_gpu, hidden_size,
+		                          range.offset >> 1, (range.size + 1) >> 1, fault_addr))
+		{
+			if (fault_hidden)
+				*fault_hidden = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
 static inline bool compare_image(const std::vector<Interface::RGBA> &reference,
                                  unsigned reference_width, unsigned reference_height,
                                  const std::vector<Interface::RGBA> &gpu, unsigned gpu_width, unsigned gpu_height)
@@ -338,6 +338,16 @@ enum class VIRegister
 	Count
 };
 
+enum class VIInterlaceMode
+{
+	// Every field is scanned out as a half-height image.
+	Off,
+	// Full-height image, with the other lines taken from the previous field.
+	Weave,
+	// Full-height image, with every line of the field repeated.
+	Bob
+};
+
 enum VIControlFlagBits
 {
 	VI_CONTROL_TYPE_BLANK_BIT = 0 << 0,
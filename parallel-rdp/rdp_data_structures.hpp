@@ -208,13 +208,15 @@ static_assert((sizeof(SpanSetup) & 15) == 0, "SpanSetup is not aligned to 16 byt
 
 struct SpanInfoOffsets
 {
-	uint32_t offset, ylo, yhi, padding;
+	uint32_t offset, ylo, yhi, num_lines;
 };
 static_assert((sizeof(SpanInfoOffsets) == 16), "SpanInfoOffsets is not 16 bytes.");
 
+// Span lines of consecutive primitives are packed tightly.
+// A job covers DefaultWorkgroupSize span lines, starting with the lines of primitive_index.
 struct SpanInterpolationJob
 {
-	uint32_t primitive_index, base_y;
+	uint32_t primitive_index, padding;
 };
 static_assert((sizeof(SpanInterpolationJob) == 8), "SpanInterpolationJob is not 8 bytes.");
 
@@ -340,7 +342,7 @@ private:
 
 namespace Limits
 {
-constexpr unsigned MaxPrimitives = 0x1000;
+constexpr unsigned MaxPrimitives = 0x4000;
 constexpr unsigned MaxStaticRasterizationStates = 64;
 constexpr unsigned MaxDepthBlendStates = 256;
 constexpr unsigned MaxTileInfoStates = 256;
@@ -357,8 +359,12 @@ namespace ImplementationConstants
 {
 constexpr unsigned DefaultWorkgroupSize = 64;
 
+// Smallest (and default) raster tile size. Binning buffers are sized for this tile size.
+// Larger tiles up to MaxTileWidth x MaxTileHeight can be selected at runtime.
 constexpr unsigned TileWidth = 8;
 constexpr unsigned TileHeight = 8;
+constexpr unsigned MaxTileWidth = 16;
+constexpr unsigned MaxTileHeight = 16;
 constexpr unsigned TileLowresDownsampleLog2 = 2;
 constexpr unsigned TileLowresDownsample = 1u << TileLowresDownsampleLog2;
 constexpr unsigned TileWidthLowres = TileWidth * TileLowresDownsample;
@@ -42,7 +42,9 @@ CommandProcessor::CommandProcessor(Vulkan::Device &device_, void *rdram_ptr, siz
 {
 	BufferCreateInfo info = {};
 	info.size = rdram_size;
-	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+	             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+	             VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	info.domain = BufferDomain::CachedHost;
 	info.misc = BUFFER_MISC_ZERO_INITIALIZE_BIT;
 
@@ -69,6 +71,17 @@ CommandProcessor::CommandProcessor(Vulkan::Device &device_, void *rdram_ptr, siz
 	clear_tmem();
 	init_renderer();
 
+	if ((flags & COMMAND_PROCESSOR_FLAG_CALIBRATE_TILE_SIZE_BIT) != 0 ||
+	    renderer.raster_tile_size_calibration_requested())
+	{
+		renderer.calibrate_raster_tile_size();
+		// The calibration workload clobbers hidden RDRAM.
+		clear_hidden_rdram();
+	}
+
+	// CPU writes to imported RDRAM are invisible to us, so we cannot know when scanout is stale.
+	vi.set_scanout_reuse(rdram_ptr == nullptr);
+
 	ring.init(
 #ifdef PARALLEL_RDP_SHADER_DIR
 			Granite::Global::create_thread_context(),
@@ -152,7 +165,7 @@ static int32_t sext(int32_t v)
 	return d.dummy;
 }
 
-static void decode_triangle_setup(TriangleSetup &setup, const uint32_t *words, bool copy_cycle)
+void decode_triangle_setup(TriangleSetup &setup, const uint32_t *words, bool copy_cycle)
 {
 	bool flip = (words[0] & 0x800000u) != 0;
 	bool sign_dxhdy = (words[5] & 0x80000000u) != 0;
@@ -174,7 +187,7 @@ static void decode_triangle_setup(TriangleSetup &setup, const uint32_t *words, b
 	setup.dxmdy = sext<28>(words[7] >> 2) & ~1;
 }
 
-static void decode_tex_setup(AttributeSetup &attr, const uint32_t *words)
+void decode_tex_setup(AttributeSetup &attr, const uint32_t *words)
 {
 	attr.s = (words[0] & 0xffff0000u) | ((words[4] >> 16) & 0x0000ffffu);
 	attr.t = ((words[0] << 16) & 0xffff0000u) | (words[4] & 0x0000ffffu);
@@ -193,7 +206,7 @@ static void decode_tex_setup(AttributeSetup &attr, const uint32_t *words)
 	attr.dwdy = (words[11] & 0xffff0000u) | ((words[15] >> 16) & 0x0000ffffu);
 }
 
-static void decode_rgba_setup(AttributeSetup &attr, const uint32_t *words)
+void decode_rgba_setup(AttributeSetup &attr, const uint32_t *words)
 {
 	attr.r = (words[0] & 0xffff0000u) | ((words[4] >> 16) & 0xffff);
 	attr.g = (words[0] << 16) | (words[4] & 0xffff);
@@ -216,7 +229,7 @@ static void decode_rgba_setup(AttributeSetup &attr, const uint32_t *words)
 	attr.dady = (words[11] << 16) | (words[15] & 0xffff);
 }
 
-static void decode_z_setup(AttributeSetup &attr, const uint32_t *words)
+void decode_z_setup(AttributeSetup &attr, const uint32_t *words)
 {
 	attr.z = words[0];
 	attr.dzdx = words[1];
@@ -299,14 +312,11 @@ void CommandProcessor::op_shade_texture_triangle(const uint32_t *words)
 	renderer.draw_shaded_primitive(setup, attr);
 }
 
-void CommandProcessor::op_set_color_image(const uint32_t *words)
+bool decode_color_image_format(FBFormat &fbfmt, const uint32_t *words)
 {
 	unsigned fmt = (words[0] >> 21) & 7;
 	unsigned size = (words[0] >> 19) & 3;
-	unsigned width = (words[0] & 1023) + 1;
-	unsigned addr = words[1] & 0xffffff;
 
-	FBFormat fbfmt;
 	switch (size)
 	{
 	case 0:
@@ -327,9 +337,21 @@ void CommandProcessor::op_set_color_image(const uint32_t *words)
 
 	default:
 		LOGE("Invalid pixel size %u.\n", size);
-		return;
+		return false;
 	}
 
+	return true;
+}
+
+void CommandProcessor::op_set_color_image(const uint32_t *words)
+{
+	unsigned width = (words[0] & 1023) + 1;
+	unsigned addr = words[1] & 0xffffff;
+
+	FBFormat fbfmt;
+	if (!decode_color_image_format(fbfmt, words))
+		return;
+
 	renderer.set_color_framebuffer(addr, width, fbfmt);
 }
 
@@ -339,7 +361,7 @@ void CommandProcessor::op_set_mask_image(const uint32_t *words)
 	renderer.set_depth_framebuffer(addr);
 }
 
-void CommandProcessor::op_set_scissor(const uint32_t *words)
+void decode_scissor(ScissorState &scissor_state, StaticRasterizationState &static_state, const uint32_t *words)
 {
 	scissor_state.xlo = (words[0] >> 12) & 0xfff;
 	scissor_state.xhi = (words[1] >> 12) & 0xfff;
@@ -348,11 +370,16 @@ void CommandProcessor::op_set_scissor(const uint32_t *words)
 
 	STATE_MASK(static_state.flags, bool(words[1] & (1 << 25)), RASTERIZATION_INTERLACE_FIELD_BIT);
 	STATE_MASK(static_state.flags, bool(words[1] & (1 << 24)), RASTERIZATION_INTERLACE_KEEP_ODD_BIT);
+}
+
+void CommandProcessor::op_set_scissor(const uint32_t *words)
+{
+	decode_scissor(scissor_state, static_state, words);
 	renderer.set_scissor_state(scissor_state);
 	renderer.set_static_rasterization_state(static_state);
 }
 
-void CommandProcessor::op_set_other_modes(const uint32_t *words)
+void decode_other_modes(StaticRasterizationState &static_state, DepthBlendState &depth_blend, const uint32_t *words)
 {
 	STATE_MASK(static_state.flags, bool(words[0] & (1 << 19)), RASTERIZATION_PERSPECTIVE_CORRECT_BIT);
 	STATE_MASK(static_state.flags, bool(words[0] & (1 << 18)), RASTERIZATION_DETAIL_LOD_ENABLE_BIT);
@@ -411,7 +438,11 @@ void CommandProcessor::op_set_other_modes(const uint32_t *words)
 	depth_blend.blend_cycles[1].blend_2a = static_cast<BlendMode2A>((words[1] >> 20) & 3);
 	depth_blend.blend_cycles[0].blend_2b = static_cast<BlendMode2B>((words[1] >> 18) & 3);
 	depth_blend.blend_cycles[1].blend_2b = static_cast<BlendMode2B>((words[1] >> 16) & 3);
+}
 
+void CommandProcessor::op_set_other_modes(const uint32_t *words)
+{
+	decode_other_modes(static_state, depth_blend, words);
 	renderer.set_static_rasterization_state(static_state);
 	renderer.set_depth_blend_state(depth_blend);
 	renderer.set_enable_primitive_depth(bool(words[1] & (1 << 2)));
@@ -536,7 +567,7 @@ void CommandProcessor::op_set_tile_size(const uint32_t *words)
 	renderer.set_tile_size(tile, slo, shi, tlo, thi);
 }
 
-void CommandProcessor::op_set_combine(const uint32_t *words)
+void decode_combine(StaticRasterizationState &static_state, const uint32_t *words)
 {
 	static_state.combiner[0].rgb.muladd = static_cast<RGBMulAdd>((words[0] >> 20) & 0xf);
 	static_state.combiner[0].rgb.mul = static_cast<RGBMul>((words[0] >> 15) & 0x1f);
@@ -557,7 +588,11 @@ void CommandProcessor::op_set_combine(const uint32_t *words)
 	static_state.combiner[1].alpha.mulsub = static_cast<AlphaAddSub>((words[1] >> 3) & 0x7);
 	static_state.combiner[1].alpha.mul = static_cast<AlphaMul>((words[1] >> 18) & 0x7);
 	static_state.combiner[1].alpha.add = static_cast<AlphaAddSub>((words[1] >> 0) & 0x7);
+}
 
+void CommandProcessor::op_set_combine(const uint32_t *words)
+{
+	decode_combine(static_state, words);
 	renderer.set_static_rasterization_state(static_state);
 }
 
@@ -775,6 +810,16 @@ void CommandProcessor::set_vi_register(VIRegister reg, uint32_t value)
 	vi.set_vi_register(reg, value);
 }
 
+void CommandProcessor::set_vi_fused_scanout(bool enable)
+{
+	vi.set_fused_scanout(enable);
+}
+
+void CommandProcessor::set_vi_interlace_mode(VIInterlaceMode mode)
+{
+	vi.set_interlace_mode(mode);
+}
+
 void *CommandProcessor::begin_read_rdram()
 {
 	return device.map_host_buffer(*rdram, MEMORY_ACCESS_READ_BIT);
@@ -783,6 +828,7 @@ void *CommandProcessor::begin_read_rdram()
 void CommandProcessor::end_write_rdram()
 {
 	device.unmap_host_buffer(*rdram, MEMORY_ACCESS_WRITE_BIT);
+	vi.notify_rdram_write(0, rdram->get_create_info().size);
 }
 
 void *CommandProcessor::begin_read_hidden_rdram()
@@ -793,6 +839,8 @@ void *CommandProcessor::begin_read_hidden_rdram()
 void CommandProcessor::end_write_hidden_rdram()
 {
 	device.unmap_host_buffer(*hidden_rdram, MEMORY_ACCESS_WRITE_BIT);
+	// Coverage lives in hidden RDRAM, so this affects VI as well.
+	vi.notify_rdram_write(0, rdram->get_create_info().size);
 }
 
 size_t CommandProcessor::get_rdram_size() const
@@ -844,10 +892,18 @@ void CommandProcessor::wait_for_timeline(uint64_t index)
 	});
 }
 
+void CommandProcessor::notify_vi_rdram_writes()
+{
+	for (auto &range : renderer.get_written_rdram_ranges())
+		vi.notify_rdram_write(range.offset, range.size);
+	renderer.clear_written_rdram_ranges();
+}
+
 Vulkan::ImageHandle CommandProcessor::scanout()
 {
 	ring.drain();
 	renderer.flush();
+	notify_vi_rdram_writes();
 	auto scanout = vi.scanout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	return scanout;
 }
@@ -857,6 +913,7 @@ void CommandProcessor::scanout_sync(std::vector<RGBA> &colors, unsigned &width,
 	ring.drain();
 
 	renderer.flush();
+	notify_vi_rdram_writes();
 	auto handle = vi.scanout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
 	if (!handle)
@@ -43,10 +43,22 @@ struct RGBA
 	uint8_t r, g, b, a;
 };
 
+// Decoders for raw RDP command words, as used by CommandProcessor.
+// These do not touch any renderer state, so they can also be used to analyze command streams offline.
+void decode_triangle_setup(TriangleSetup &setup, const uint32_t *words, bool copy_cycle);
+void decode_tex_setup(AttributeSetup &attr, const uint32_t *words);
+void decode_rgba_setup(AttributeSetup &attr, const uint32_t *words);
+void decode_z_setup(AttributeSetup &attr, const uint32_t *words);
+bool decode_color_image_format(FBFormat &fmt, const uint32_t *words);
+void decode_scissor(ScissorState &scissor_state, StaticRasterizationState &static_state, const uint32_t *words);
+void decode_other_modes(StaticRasterizationState &static_state, DepthBlendState &depth_blend, const uint32_t *words);
+void decode_combine(StaticRasterizationState &static_state, const uint32_t *words);
+
 enum CommandProcessorFlagBits
 {
 	COMMAND_PROCESSOR_FLAG_HOST_VISIBLE_HIDDEN_RDRAM_BIT = 1 << 0,
-	COMMAND_PROCESSOR_FLAG_HOST_VISIBLE_TMEM_BIT = 1 << 1
+	COMMAND_PROCESSOR_FLAG_HOST_VISIBLE_TMEM_BIT = 1 << 1,
+	COMMAND_PROCESSOR_FLAG_CALIBRATE_TILE_SIZE_BIT = 1 << 2
 };
 using CommandProcessorFlags = uint32_t;
 
@@ -83,6 +95,10 @@ public:
 
 	// Sets VI register
 	void set_vi_register(VIRegister reg, uint32_t value);
+	// Selects the fused single-dispatch compute path for VI scanout.
+	void set_vi_fused_scanout(bool enable);
+	// Selects how interlaced fields are combined into a frame on scanout.
+	void set_vi_interlace_mode(VIInterlaceMode mode);
 
 	Vulkan::ImageHandle scanout();
 	void scanout_sync(std::vector<RGBA> &colors, unsigned &width, unsigned &height);
@@ -102,6 +118,7 @@ private:
 	Renderer renderer;
 
 	void clear_hidden_rdram();
+	void notify_vi_rdram_writes();
 	void clear_tmem();
 	void clear_buffer(Vulkan::Buffer &buffer, uint32_t value);
 	void init_renderer();
@@ -22,7 +22,9 @@
 
 #include "rdp_renderer.hpp"
 #include "util.hpp"
+#include "timer.hpp"
 #include "luts.hpp"
+#include <limits>
 #ifdef PARALLEL_RDP_SHADER_DIR
 #include "global_managers.hpp"
 #include "os_filesystem.hpp"
@@ -104,6 +106,12 @@ bool Renderer::init_caps()
 		LOGI("Overriding ubershader = %d\n", int(caps.ubershader));
 	}
 
+	if (const char *resident = getenv("PARALLEL_RDP_RESIDENT_FRAMEBUFFER"))
+	{
+		caps.resident_framebuffer = strtol(resident, nullptr, 0) > 0;
+		LOGI("Overriding resident framebuffer = %d\n", int(caps.resident_framebuffer));
+	}
+
 	if (const char *force_sync = getenv("PARALLEL_RDP_FORCE_SYNC_SHADER"))
 	{
 		caps.force_sync = strtol(force_sync, nullptr, 0) > 0;
@@ -174,9 +182,180 @@ bool Renderer::init_caps()
 			(features.subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0 &&
 			can_support_minimum_subgroup_size(32) && subgroup_size <= 64;
 
+	if (const char *tile_size = getenv("PARALLEL_RDP_TILE_SIZE"))
+	{
+		unsigned width = 0, height = 0;
+		if (strcmp(tile_size, "calibrate") == 0)
+		{
+			caps.calibrate_raster_tile_size = true;
+			LOGI("Calibrating raster tile size.\n");
+		}
+		else if (sscanf(tile_size, "%ux%u", &width, &height) == 2 && set_raster_tile_size(width, height))
+			LOGI("Overriding raster tile size = %ux%u\n", width, height);
+		else
+			LOGW("Invalid raster tile size \"%s\", ignoring.\n", tile_size);
+	}
+
 	return true;
 }
 
+bool Renderer::set_raster_tile_size(unsigned width, unsigned height)
+{
+	bool supported = (width == 8 && height == 8) ||
+	                 (width == 16 && height == 8) ||
+	                 (width == 16 && height == 16);
+	if (!supported)
+		return false;
+
+	// Depth blend and rasterization run one workgroup per tile.
+	auto &limits = device->get_gpu_properties().limits;
+	if (width * height > limits.maxComputeWorkGroupInvocations ||
+	    width > limits.maxComputeWorkGroupSize[0] ||
+	    height > limits.maxComputeWorkGroupSize[1])
+	{
+		return false;
+	}
+
+	// Tile instance budget is estimated with the current tile size.
+	flush_queues();
+
+	raster_tile.width = width;
+	raster_tile.height = height;
+	// Per-tile shading buffers are sized for MaxTileInstances 8x8 tiles, so keep the pixel budget constant.
+	raster_tile.max_tile_instances = Limits::MaxTileInstances *
+	                                 (ImplementationConstants::TileWidth * ImplementationConstants::TileHeight) /
+	                                 (width * height);
+	return true;
+}
+
+bool Renderer::raster_tile_size_calibration_requested() const
+{
+	return caps.calibrate_raster_tile_size;
+}
+
+void Renderer::calibrate_raster_tile_size()
+{
+	static const struct
+	{
+		unsigned width, height;
+	} candidates[] = {
+		{ 8, 8 },
+		{ 16, 8 },
+		{ 16, 16 },
+	};
+
+	constexpr uint32_t fb_width = 320;
+	constexpr uint32_t fb_height = 240;
+	constexpr uint32_t fb_size = fb_width * fb_height * 2;
+	constexpr unsigned num_primitives = 4 * 1024;
+	constexpr unsigned num_iterations = 4;
+
+	// The workload renders to the start of RDRAM, so save it and restore it once we're done.
+	std::vector<uint8_t> saved_rdram(2 * fb_size);
+	device->wait_idle();
+	memcpy(saved_rdram.data(), device->map_host_buffer(*rdram, Vulkan::MEMORY_ACCESS_READ_BIT), saved_rdram.size());
+	device->unmap_host_buffer(*rdram, Vulkan::MEMORY_ACCESS_READ_BIT);
+
+	auto saved_fb = fb;
+	auto saved_scissor = stream.scissor_state;
+	auto saved_static = stream.static_raster_state;
+	auto saved_depth_blend = stream.depth_blend_state;
+	auto saved_raster_tile = raster_tile;
+	bool saved_force_sync = caps.force_sync;
+
+	// Make sure we time the real pipelines and not the ubershader fallback.
+	caps.force_sync = true;
+
+	set_color_framebuffer(0, fb_width, FBFormat::RGBA5551);
+	set_depth_framebuffer(fb_size);
+
+	ScissorState scissor = {};
+	scissor.xhi = fb_width << 2;
+	scissor.yhi = fb_height << 2;
+	set_scissor_state(scissor);
+
+	StaticRasterizationState static_state = {};
+	set_static_rasterization_state(static_state);
+
+	DepthBlendState depth_blend = {};
+	depth_blend.flags = DEPTH_BLEND_DEPTH_TEST_BIT | DEPTH_BLEND_DEPTH_UPDATE_BIT;
+	set_depth_blend_state(depth_blend);
+
+	int64_t best_time = std::numeric_limits<int64_t>::max();
+	unsigned best_width = saved_raster_tile.width;
+	unsigned best_height = saved_raster_tile.height;
+
+	for (auto &candidate : candidates)
+	{
+		if (!set_raster_tile_size(candidate.width, candidate.height))
+			continue;
+
+		int64_t candidate_time = 0;
+
+		// First iteration warms up pipelines.
+		for (unsigned iteration = 0; iteration <= num_iterations; iteration++)
+		{
+			int64_t start_time = Util::get_current_time_nsecs();
+
+			// Mix of small and medium sized rectangles, roughly what a 3D scene with some 2D overlay looks like.
+			uint32_t seed = 1;
+			for (unsigned i = 0; i < num_primitives; i++)
+			{
+				seed = seed * 1103515245u + 12345u;
+				uint32_t w = 2 + ((seed >> 8) & ((i & 7) == 0 ? 63 : 15));
+				uint32_t h = 2 + ((seed >> 16) & ((i & 7) == 0 ? 63 : 15));
+				uint32_t x = (seed >> 4) % (fb_width - w);
+				uint32_t y = (seed >> 20) % (fb_height - h);
+
+				TriangleSetup setup = {};
+				setup.xh = int32_t(x << 16);
+				setup.xl = int32_t((x + w) << 16);
+				setup.xm = setup.xl;
+				setup.yh = int16_t(y << 2);
+				setup.ym = int16_t((y + h) << 2);
+				setup.yl = setup.ym;
+				setup.flags = TRIANGLE_SETUP_FLIP_BIT;
+
+				AttributeSetup attr = {};
+				attr.r = int32_t(seed & 0xff) << 16;
+				attr.g = int32_t((seed >> 8) & 0xff) << 16;
+				attr.b = int32_t((seed >> 16) & 0xff) << 16;
+				attr.a = 0xff << 16;
+				attr.z = int32_t(i) << 16;
+				draw_shaded_primitive(setup, attr);
+			}
+
+			flush_and_signal()->wait();
+			int64_t end_time = Util::get_current_time_nsecs();
+			if (iteration != 0)
+				candidate_time += end_time - start_time;
+		}
+
+		LOGI("Raster tile size %ux%u: %.3f ms per iteration.\n",
+		     candidate.width, candidate.height, 1e-6 * double(candidate_time) / num_iterations);
+
+		if (candidate_time < best_time)
+		{
+			best_time = candidate_time;
+			best_width = candidate.width;
+			best_height = candidate.height;
+		}
+	}
+
+	set_raster_tile_size(best_width, best_height);
+	LOGI("Selected raster tile size %ux%u.\n", best_width, best_height);
+
+	fb = saved_fb;
+	stream.scissor_state = saved_scissor;
+	stream.static_raster_state = saved_static;
+	stream.depth_blend_state = saved_depth_blend;
+	caps.force_sync = saved_force_sync;
+
+	device->wait_idle();
+	memcpy(device->map_host_buffer(*rdram, Vulkan::MEMORY_ACCESS_WRITE_BIT), saved_rdram.data(), saved_rdram.size());
+	device->unmap_host_buffer(*rdram, Vulkan::MEMORY_ACCESS_WRITE_BIT);
+}
+
 int Renderer::resolve_shader_define(const char *name, const char *define) const
 {
 	if (strcmp(define, "DEBUG_ENABLE") == 0)
@@ -206,8 +385,13 @@ void Renderer::init_buffers()
 	info.misc = Vulkan::BUFFER_MISC_ZERO_INITIALIZE_BIT;
 
 	static_assert((Limits::MaxPrimitives % (32 * 32)) == 0, "MaxPrimitives must be divisble by 1024.");
+	static_assert(Limits::MaxPrimitives <= 32 * 32 * 32, "MaxPrimitives segments must fit in a 32-bit mask.");
 	static_assert((Limits::MaxWidth % ImplementationConstants::TileWidthLowres) == 0, "MaxWidth must be divisible by maximum tile width.");
 	static_assert((Limits::MaxHeight % ImplementationConstants::TileHeightLowres) == 0, "MaxHeight must be divisible by maximum tile height.");
+	static_assert((Limits::MaxWidth % (ImplementationConstants::MaxTileWidth << ImplementationConstants::TileLowresDownsampleLog2)) == 0,
+	              "MaxWidth must be divisible by maximum tile width.");
+	static_assert((Limits::MaxHeight % (ImplementationConstants::MaxTileHeight << ImplementationConstants::TileLowresDownsampleLog2)) == 0,
+	              "MaxHeight must be divisible by maximum tile height.");
 
 	info.size = sizeof(uint32_t) *
 	            (Limits::MaxPrimitives / 32) *
@@ -223,6 +407,29 @@ void Renderer::init_buffers()
 	tile_binning_buffer_coarse = device->create_buffer(info);
 	device->set_name(*tile_binning_buffer_coarse, "tile-binning-buffer-coarse");
 
+	info.size = sizeof(uint32_t) *
+	            (Limits::MaxWidth / ImplementationConstants::TileWidth) *
+	            (Limits::MaxHeight / ImplementationConstants::TileHeight);
+	tile_binning_buffer_segment = device->create_buffer(info);
+	device->set_name(*tile_binning_buffer_segment, "tile-binning-buffer-segment");
+
+	info.size = sizeof(uint32_t) *
+	            (Limits::MaxWidth / ImplementationConstants::TileWidth) *
+	            (Limits::MaxHeight / ImplementationConstants::TileHeight);
+	active_tile_list = device->create_buffer(info);
+	device->set_name(*active_tile_list, "active-tile-list");
+
+	{
+		// Only the first element is used, but clear_indirect_buffer works in units of full workgroups.
+		Vulkan::BufferCreateInfo indirect_info = {};
+		indirect_info.size = 4 * sizeof(uint32_t) * ImplementationConstants::DefaultWorkgroupSize;
+		indirect_info.domain = Vulkan::BufferDomain::Device;
+		indirect_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+		indirect_info.misc = Vulkan::BUFFER_MISC_ZERO_INITIALIZE_BIT;
+		active_tile_indirect_buffer = device->create_buffer(indirect_info);
+		device->set_name(*active_tile_indirect_buffer, "active-tile-indirect-buffer");
+	}
+
 	info.size = sizeof(uint32_t) *
 	            (Limits::MaxPrimitives / 32) *
 	            (Limits::MaxWidth / ImplementationConstants::TileWidthLowres) *
@@ -489,6 +696,21 @@ void Renderer::set_rdram(Vulkan::Buffer *buffer)
 {
 	rdram = buffer;
 	device->set_name(*rdram, "rdram");
+
+	resident_rdram.reset();
+	resident_fb = {};
+
+	if (caps.resident_framebuffer)
+	{
+		Vulkan::BufferCreateInfo info = {};
+		info.size = rdram->get_create_info().size;
+		info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+		             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+		             VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		info.domain = Vulkan::BufferDomain::Device;
+		resident_rdram = device->create_buffer(info);
+		device->set_name(*resident_rdram, "resident-rdram");
+	}
 }
 
 void Renderer::set_hidden_rdram(Vulkan::Buffer *buffer)
@@ -849,10 +1071,10 @@ unsigned Renderer::compute_conservative_max_num_tiles(const TriangleSetup &setup
 	if (end_x < start_x)
 		return 0;
 
-	start_x /= ImplementationConstants::TileWidth;
-	end_x /= ImplementationConstants::TileWidth;
-	start_y /= (SUBPIXELS_Y * ImplementationConstants::TileHeight);
-	end_y /= (SUBPIXELS_Y * ImplementationConstants::TileHeight);
+	start_x /= int(raster_tile.width);
+	end_x /= int(raster_tile.width);
+	start_y /= (SUBPIXELS_Y * int(raster_tile.height));
+	end_y /= (SUBPIXELS_Y * int(raster_tile.height));
 
 	return (end_x - start_x + 1) * (end_y - start_y + 1);
 }
@@ -1233,7 +1455,7 @@ void Renderer::draw_shaded_primitive(const TriangleSetup &setup, const Attribute
 		fb.depth_write_pending = true;
 
 	if (need_flush())
-		flush_queues();
+		flush_queues(true);
 }
 
 SpanInfoOffsets Renderer::allocate_span_jobs(const TriangleSetup &setup)
@@ -1248,18 +1470,19 @@ SpanInfoOffsets Renderer::allocate_span_jobs(const TriangleSetup &setup)
 	int height = std::max(max_active_line - min_active_line + 2, 0);
 	height = std::min(height, 1024);
 
-	int num_jobs = (height + ImplementationConstants::DefaultWorkgroupSize - 1) / ImplementationConstants::DefaultWorkgroupSize;
-
 	SpanInfoOffsets offsets = {};
-	offsets.offset = uint32_t(stream.span_info_jobs.size()) * ImplementationConstants::DefaultWorkgroupSize;
+	offsets.offset = stream.num_span_lines;
 	offsets.ylo = min_active_line;
 	offsets.yhi = max_active_line;
+	offsets.num_lines = height;
 
-	for (int i = 0; i < num_jobs; i++)
+	// Pack span lines tightly, so small primitives share jobs.
+	// Every job which starts inside this primitive's lines begins with this primitive.
+	stream.num_span_lines += height;
+	while (stream.span_info_jobs.size() * ImplementationConstants::DefaultWorkgroupSize < stream.num_span_lines)
 	{
 		SpanInterpolationJob interpolation_job = {};
 		interpolation_job.primitive_index = uint32_t(stream.triangle_setup.size());
-		interpolation_job.base_y = min_active_line + ImplementationConstants::DefaultWorkgroupSize * i;
 		stream.span_info_jobs.add(interpolation_job);
 	}
 	return offsets;
@@ -1283,9 +1506,10 @@ bool Renderer::need_flush() const
 	bool triangle_full =
 			stream.triangle_setup.full();
 	bool span_info_full =
-			(stream.span_info_jobs.size() * ImplementationConstants::DefaultWorkgroupSize + Limits::MaxHeight > Limits::MaxSpanSetups);
+			(stream.num_span_lines + Limits::MaxHeight > Limits::MaxSpanSetups);
+	unsigned max_tiles = (Limits::MaxWidth / raster_tile.width) * (Limits::MaxHeight / raster_tile.height);
 	bool max_shaded_tiles =
-			(stream.max_shaded_tiles + ImplementationConstants::MaxTilesX * ImplementationConstants::MaxTilesY > Limits::MaxTileInstances);
+			(stream.max_shaded_tiles + max_tiles > raster_tile.max_tile_instances);
 
 	if (cache_full)
 		LOGI("Cache is full.\n");
@@ -1380,6 +1604,7 @@ void Renderer::submit_span_setup_jobs(Vulkan::CommandBuffer &cmd)
 	cmd.set_storage_buffer(0, 1, *instance.gpu.attribute_setup.buffer);
 	cmd.set_storage_buffer(0, 2, *instance.gpu.scissor_setup.buffer);
 	cmd.set_storage_buffer(0, 3, *span_setups);
+	cmd.set_storage_buffer(0, 4, *instance.gpu.span_info_offsets.buffer);
 
 #ifdef PARALLEL_RDP_SHADER_DIR
 	cmd.set_program("rdp://span_setup.comp", {{ "DEBUG_ENABLE", debug_channel ? 1 : 0 }});
@@ -1391,6 +1616,15 @@ void Renderer::submit_span_setup_jobs(Vulkan::CommandBuffer &cmd)
 	cmd.set_specialization_constant_mask(1);
 	cmd.set_specialization_constant(0, ImplementationConstants::DefaultWorkgroupSize);
 
+	struct PushData
+	{
+		uint32_t num_jobs;
+		uint32_t num_primitives;
+	} push = {};
+	push.num_jobs = stream.span_info_jobs.size();
+	push.num_primitives = stream.triangle_setup.size();
+	cmd.push_constants(&push, 0, sizeof(push));
+
 	Vulkan::QueryPoolHandle begin_ts, end_ts;
 	if (caps.timestamp)
 		begin_ts = cmd.write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
@@ -1412,8 +1646,8 @@ void Renderer::submit_tile_binning_prepass(Vulkan::CommandBuffer &cmd)
 	cmd.set_storage_buffer(0, 2, *instance.gpu.scissor_setup.buffer);
 
 	cmd.set_specialization_constant_mask(0x3f);
-	cmd.set_specialization_constant(1, ImplementationConstants::TileWidth);
-	cmd.set_specialization_constant(2, ImplementationConstants::TileHeight);
+	cmd.set_specialization_constant(1, raster_tile.width);
+	cmd.set_specialization_constant(2, raster_tile.height);
 	cmd.set_specialization_constant(3, ImplementationConstants::TileLowresDownsample);
 	cmd.set_specialization_constant(4, Limits::MaxPrimitives);
 	cmd.set_specialization_constant(5, Limits::MaxWidth);
@@ -1431,6 +1665,8 @@ void Renderer::submit_tile_binning_prepass(Vulkan::CommandBuffer &cmd)
 
 	auto &features = device->get_device_features();
 	uint32_t subgroup_size = features.subgroup_properties.subgroupSize;
+	uint32_t tile_width_lowres = raster_tile.width << ImplementationConstants::TileLowresDownsampleLog2;
+	uint32_t tile_height_lowres = raster_tile.height << ImplementationConstants::TileLowresDownsampleLog2;
 
 	Vulkan::QueryPoolHandle begin_ts, end_ts;
 	if (caps.timestamp)
@@ -1456,10 +1692,8 @@ void Renderer::submit_tile_binning_prepass(Vulkan::CommandBuffer &cmd)
 		}
 
 		cmd.dispatch((push.num_primitives + subgroup_size - 1) / subgroup_size,
-		             (push.width + ImplementationConstants::TileWidthLowres - 1) /
-		             ImplementationConstants::TileWidthLowres,
-		             (push.height + ImplementationConstants::TileHeightLowres - 1) /
-		             ImplementationConstants::TileHeightLowres);
+		             (push.width + tile_width_lowres - 1) / tile_width_lowres,
+		             (push.height + tile_height_lowres - 1) / tile_height_lowres);
 	}
 	else
 	{
@@ -1475,10 +1709,8 @@ void Renderer::submit_tile_binning_prepass(Vulkan::CommandBuffer &cmd)
 
 		cmd.set_specialization_constant(0, 32);
 		cmd.dispatch((push.num_primitives + 31) / 32,
-		             (push.width + ImplementationConstants::TileWidthLowres - 1) /
-		             ImplementationConstants::TileWidthLowres,
-		             (push.height + ImplementationConstants::TileHeightLowres - 1) /
-		             ImplementationConstants::TileHeightLowres);
+		             (push.width + tile_width_lowres - 1) / tile_width_lowres,
+		             (push.height + tile_height_lowres - 1) / tile_height_lowres);
 	}
 
 	if (caps.timestamp)
@@ -1501,12 +1733,18 @@ void Renderer::clear_indirect_buffer(Vulkan::CommandBuffer &cmd)
 	cmd.set_program(shader_bank->clear_indirect_buffer);
 #endif
 
-	cmd.set_storage_buffer(0, 0, *indirect_dispatch_buffer);
-
-	static_assert((Limits::MaxStaticRasterizationStates % ImplementationConstants::DefaultWorkgroupSize) == 0, "MaxStaticRasterizationStates does not align.");
 	cmd.set_specialization_constant_mask(1);
 	cmd.set_specialization_constant(0, ImplementationConstants::DefaultWorkgroupSize);
-	cmd.dispatch(Limits::MaxStaticRasterizationStates / ImplementationConstants::DefaultWorkgroupSize, 1, 1);
+
+	if (!caps.ubershader)
+	{
+		cmd.set_storage_buffer(0, 0, *indirect_dispatch_buffer);
+		static_assert((Limits::MaxStaticRasterizationStates % ImplementationConstants::DefaultWorkgroupSize) == 0, "MaxStaticRasterizationStates does not align.");
+		cmd.dispatch(Limits::MaxStaticRasterizationStates / ImplementationConstants::DefaultWorkgroupSize, 1, 1);
+	}
+
+	cmd.set_storage_buffer(0, 0, *active_tile_indirect_buffer);
+	cmd.dispatch(1, 1, 1);
 	cmd.end_region();
 }
 
@@ -1570,8 +1808,8 @@ void Renderer::submit_rasterization(Vulkan::CommandBuffer &cmd, Vulkan::Buffer &
 	cmd.set_program(shader_bank->rasterizer);
 #endif
 
-	cmd.set_specialization_constant(0, ImplementationConstants::TileWidth);
-	cmd.set_specialization_constant(1, ImplementationConstants::TileHeight);
+	cmd.set_specialization_constant(0, raster_tile.width);
+	cmd.set_specialization_constant(1, raster_tile.height);
 
 	Vulkan::QueryPoolHandle start_ts, end_ts;
 	if (caps.timestamp)
@@ -1626,6 +1864,9 @@ void Renderer::submit_tile_binning_complete(Vulkan::CommandBuffer &cmd)
 	cmd.set_storage_buffer(0, 3, *tile_binning_buffer);
 	cmd.set_storage_buffer(0, 4, *tile_binning_buffer_prepass);
 	cmd.set_storage_buffer(0, 5, *tile_binning_buffer_coarse);
+	cmd.set_storage_buffer(0, 9, *tile_binning_buffer_segment);
+	cmd.set_storage_buffer(0, 10, *active_tile_list);
+	cmd.set_storage_buffer(0, 11, *active_tile_indirect_buffer);
 
 	if (!caps.ubershader)
 	{
@@ -1635,8 +1876,8 @@ void Renderer::submit_tile_binning_complete(Vulkan::CommandBuffer &cmd)
 	}
 
 	cmd.set_specialization_constant_mask(0x7f);
-	cmd.set_specialization_constant(1, ImplementationConstants::TileWidth);
-	cmd.set_specialization_constant(2, ImplementationConstants::TileHeight);
+	cmd.set_specialization_constant(1, raster_tile.width);
+	cmd.set_specialization_constant(2, raster_tile.height);
 	cmd.set_specialization_constant(3, ImplementationConstants::TileLowresDownsampleLog2);
 	cmd.set_specialization_constant(4, Limits::MaxPrimitives);
 	cmd.set_specialization_constant(5, Limits::MaxWidth);
@@ -1683,8 +1924,8 @@ void Renderer::submit_tile_binning_complete(Vulkan::CommandBuffer &cmd)
 		}
 
 		cmd.dispatch((push.num_primitives_32 + subgroup_size - 1) / subgroup_size,
-		             (push.width + ImplementationConstants::TileWidth - 1) / ImplementationConstants::TileWidth,
-		             (push.height + ImplementationConstants::TileHeight - 1) / ImplementationConstants::TileHeight);
+		             (push.width + raster_tile.width - 1) / raster_tile.width,
+		             (push.height + raster_tile.height - 1) / raster_tile.height);
 	}
 	else
 	{
@@ -1701,8 +1942,8 @@ void Renderer::submit_tile_binning_complete(Vulkan::CommandBuffer &cmd)
 
 		cmd.set_specialization_constant(0, 32);
 		cmd.dispatch((push.num_primitives_32 + 31) / 32,
-		             (push.width + ImplementationConstants::TileWidth - 1) / ImplementationConstants::TileWidth,
-		             (push.height + ImplementationConstants::TileHeight - 1) / ImplementationConstants::TileHeight);
+		             (push.width + raster_tile.width - 1) / raster_tile.width,
+		             (push.height + raster_tile.height - 1) / raster_tile.height);
 	}
 
 	if (caps.timestamp)
@@ -1715,11 +1956,196 @@ void Renderer::submit_tile_binning_complete(Vulkan::CommandBuffer &cmd)
 	cmd.end_region();
 }
 
-void Renderer::submit_render_pass()
+static uint32_t get_framebuffer_bytes_per_pixel(FBFormat fmt)
+{
+	switch (fmt)
+	{
+	case FBFormat::RGBA5551:
+	case FBFormat::IA88:
+		return 2;
+
+	case FBFormat::RGBA8888:
+		return 4;
+
+	default:
+		return 1;
+	}
+}
+
+void Renderer::add_written_rdram_range(uint32_t offset, uint32_t size)
+{
+	// Almost always the same few framebuffers over and over.
+	for (auto &range : written_rdram_ranges)
+		if (range.offset == offset && range.size == size)
+			return;
+
+	if (written_rdram_ranges.size() >= MaxWrittenRDRAMRanges)
+	{
+		written_rdram_ranges.clear();
+		written_rdram_ranges.push_back({ 0, uint32_t(rdram->get_create_info().size) });
+	}
+	else
+		written_rdram_ranges.push_back({ offset, size });
+}
+
+const std::vector<Renderer::RDRAMRange> &Renderer::get_written_rdram_ranges() const
+{
+	return written_rdram_ranges;
+}
+
+void Renderer::clear_written_rdram_ranges()
+{
+	written_rdram_ranges.clear();
+}
+
+unsigned Renderer::merge_byte_ranges(ByteRange *ranges, const ByteRange &a, const ByteRange &b)
+{
+	unsigned count = 0;
+	if (a.begin < a.end)
+		ranges[count++] = a;
+	if (b.begin < b.end)
+		ranges[count++] = b;
+
+	if (count == 2)
+	{
+		if (ranges[1].begin < ranges[0].begin)
+			std::swap(ranges[0], ranges[1]);
+
+		if (ranges[1].begin <= ranges[0].end)
+		{
+			ranges[0].end = std::max(ranges[0].end, ranges[1].end);
+			count = 1;
+		}
+	}
+
+	return count;
+}
+
+bool Renderer::begin_resident_framebuffer(Vulkan::CommandBuffer &cmd)
+{
+	uint32_t rdram_size = rdram->get_create_info().size;
+	uint32_t bytes_per_pixel = get_framebuffer_bytes_per_pixel(fb.fmt);
+
+	// Byte ranges actually accessed by depth blending, see memory_interfacing.h.
+	uint32_t color_addr = fb.addr & ~(bytes_per_pixel - 1);
+	uint32_t depth_addr = fb.depth_addr & ~1u;
+	uint32_t color_size = fb.width * fb.deduced_height * bytes_per_pixel;
+	uint32_t depth_size = fb.width * fb.deduced_height * 2;
+
+	// Wrapping around RDRAM is legal, but not worth dealing with.
+	bool can_be_resident = resident_rdram &&
+	                       color_addr < rdram_size && color_size <= rdram_size - color_addr &&
+	                       depth_addr < rdram_size && depth_size <= rdram_size - depth_addr;
+
+	if (!can_be_resident)
+	{
+		if (resident_fb.valid)
+		{
+			resolve_resident_framebuffer(cmd);
+			cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+			            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		}
+		return false;
+	}
+
+	if (!resident_fb.valid)
+	{
+		resident_fb.color_addr = color_addr;
+		resident_fb.depth_addr = depth_addr;
+		resident_fb.color_size = 0;
+		resident_fb.depth_size = 0;
+		resident_fb.valid = true;
+	}
+
+	// The framebuffer cannot change while resident, but deduced height might grow, so pull in more rows as needed.
+	// Color and depth may overlap, so only copy bytes which are in neither resident range yet.
+	// Otherwise, growing one range would clobber rows of the other which have already been rendered to in the mirror.
+	ByteRange wanted[2];
+	unsigned num_wanted = merge_byte_ranges(wanted, { color_addr, color_addr + color_size },
+	                                        { depth_addr, depth_addr + depth_size });
+
+	ByteRange resident[2];
+	unsigned num_resident = merge_byte_ranges(resident,
+	                                          { resident_fb.color_addr, resident_fb.color_addr + resident_fb.color_size },
+	                                          { resident_fb.depth_addr, resident_fb.depth_addr + resident_fb.depth_size });
+
+	bool did_copy = false;
+	for (unsigned i = 0; i < num_wanted; i++)
+	{
+		// Subtracting at most two disjoint ranges leaves at most three pieces.
+		ByteRange pieces[3] = { wanted[i] };
+		unsigned num_pieces = 1;
+
+		for (unsigned j = 0; j < num_resident; j++)
+		{
+			ByteRange remaining[3];
+			unsigned num_remaining = 0;
+			for (unsigned k = 0; k < num_pieces; k++)
+			{
+				auto &piece = pieces[k];
+				if (resident[j].end <= piece.begin || resident[j].begin >= piece.end)
+				{
+					remaining[num_remaining++] = piece;
+					continue;
+				}
+
+				if (piece.begin < resident[j].begin)
+					remaining[num_remaining++] = { piece.begin, resident[j].begin };
+				if (resident[j].end < piece.end)
+					remaining[num_remaining++] = { resident[j].end, piece.end };
+			}
+
+			memcpy(pieces, remaining, num_remaining * sizeof(*remaining));
+			num_pieces = num_remaining;
+		}
+
+		for (unsigned k = 0; k < num_pieces; k++)
+		{
+			cmd.copy_buffer(*resident_rdram, pieces[k].begin, *rdram, pieces[k].begin, pieces[k].end - pieces[k].begin);
+			did_copy = true;
+		}
+	}
+
+	resident_fb.color_size = std::max(resident_fb.color_size, color_size);
+	resident_fb.depth_size = std::max(resident_fb.depth_size, depth_size);
+
+	if (did_copy)
+	{
+		cmd.barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	return true;
+}
+
+void Renderer::resolve_resident_framebuffer(Vulkan::CommandBuffer &cmd)
+{
+	cmd.begin_region("resolve-resident-framebuffer");
+	cmd.barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+	            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+	            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+	// If color and depth alias, the resident copy has the correct data for both, so copy the union once.
+	ByteRange resident[2];
+	unsigned num_resident = merge_byte_ranges(resident,
+	                                          { resident_fb.color_addr, resident_fb.color_addr + resident_fb.color_size },
+	                                          { resident_fb.depth_addr, resident_fb.depth_addr + resident_fb.depth_size });
+
+	for (unsigned i = 0; i < num_resident; i++)
+	{
+		cmd.copy_buffer(*rdram, resident[i].begin,
+		                *resident_rdram, resident[i].begin, resident[i].end - resident[i].begin);
+	}
+
+	resident_fb = {};
+	cmd.end_region();
+}
+
+void Renderer::submit_render_pass(bool keep_framebuffer_resident)
 {
 	bool need_render_pass = fb.width != 0 && fb.deduced_height != 0 && !stream.triangle_setup.empty();
 	bool need_tmem_upload = !stream.tmem_upload_infos.empty();
-	bool need_submit = need_render_pass || need_tmem_upload;
+	bool need_submit = need_render_pass || need_tmem_upload || resident_fb.valid;
 	if (!need_submit)
 		return;
 
@@ -1727,14 +2153,23 @@ void Renderer::submit_render_pass()
 	if (debug_channel)
 		cmd->begin_debug_channel(this, "Debug", 16 * 1024 * 1024);
 
+	bool use_resident_framebuffer = need_render_pass && begin_resident_framebuffer(*cmd);
+
+	if (need_render_pass)
+	{
+		uint32_t bytes_per_pixel = get_framebuffer_bytes_per_pixel(fb.fmt);
+		add_written_rdram_range(fb.addr, fb.width * fb.deduced_height * bytes_per_pixel);
+		if (fb.depth_write_pending)
+			add_written_rdram_range(fb.depth_addr, fb.width * fb.deduced_height * 2);
+	}
+
 	// Here we run 3 dispatches in parallel. Span setup and TMEM instances are low occupancy kind of jobs, but the binning
 	// pass should dominate here unless the workload is trivial.
 	if (need_render_pass)
 	{
 		submit_span_setup_jobs(*cmd);
 		submit_tile_binning_prepass(*cmd);
-		if (!caps.ubershader)
-			clear_indirect_buffer(*cmd);
+		clear_indirect_buffer(*cmd);
 	}
 
 	if (need_tmem_upload)
@@ -1751,7 +2186,8 @@ void Renderer::submit_render_pass()
 		if (caps.ubershader)
 		{
 			cmd->barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
-			             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+			             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			             VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
 		}
 		else
 		{
@@ -1772,16 +2208,20 @@ void Renderer::submit_render_pass()
 		cmd->begin_region("render-pass");
 		auto &instance = buffer_instances[buffer_instance];
 
-		cmd->set_specialization_constant_mask(0x7f);
+		// Debug messages are keyed on gl_GlobalInvocationID, so keep the full dispatch around for debugging.
+		bool use_active_tile_list = !debug_channel;
+
+		cmd->set_specialization_constant_mask(0xff);
 		cmd->set_specialization_constant(0, uint32_t(rdram->get_create_info().size));
 		cmd->set_specialization_constant(1, uint32_t(fb.fmt));
 		cmd->set_specialization_constant(2, int(fb.addr == fb.depth_addr));
-		cmd->set_specialization_constant(3, ImplementationConstants::TileWidth);
-		cmd->set_specialization_constant(4, ImplementationConstants::TileHeight);
+		cmd->set_specialization_constant(3, raster_tile.width);
+		cmd->set_specialization_constant(4, raster_tile.height);
 		cmd->set_specialization_constant(5, Limits::MaxPrimitives);
 		cmd->set_specialization_constant(6, Limits::MaxWidth);
+		cmd->set_specialization_constant(7, int(use_active_tile_list));
 
-		cmd->set_storage_buffer(0, 0, *rdram);
+		cmd->set_storage_buffer(0, 0, use_resident_framebuffer ? *resident_rdram : *rdram);
 		cmd->set_storage_buffer(0, 1, *hidden_rdram);
 		cmd->set_storage_buffer(0, 2, need_tmem_upload ? *tmem_instances : *tmem);
 
@@ -1807,6 +2247,8 @@ void Renderer::submit_render_pass()
 		cmd->set_buffer_view(1, 10, *blender_divider_buffer);
 		cmd->set_storage_buffer(1, 11, *tile_binning_buffer);
 		cmd->set_storage_buffer(1, 12, *tile_binning_buffer_coarse);
+		cmd->set_storage_buffer(1, 13, *tile_binning_buffer_segment);
+		cmd->set_storage_buffer(1, 14, *active_tile_list);
 
 		auto *global_fb_info = cmd->allocate_typed_constant_data<GlobalFBInfo>(2, 0, 1);
 
@@ -1877,7 +2319,15 @@ void Renderer::submit_render_pass()
 		Vulkan::QueryPoolHandle start_ts, end_ts;
 		if (caps.timestamp)
 			start_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
-		cmd->dispatch((push.fb_width + 7) / 8, (push.fb_height + 7) / 8, 1);
+		if (use_active_tile_list)
+		{
+			cmd->dispatch_indirect(*active_tile_indirect_buffer, 0);
+		}
+		else
+		{
+			cmd->dispatch((push.fb_width + raster_tile.width - 1) / raster_tile.width,
+			              (push.fb_height + raster_tile.height - 1) / raster_tile.height, 1);
+		}
 		if (caps.timestamp)
 		{
 			end_ts = cmd->write_timestamp(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
@@ -1889,6 +2339,14 @@ void Renderer::submit_render_pass()
 		base_primitive_index += uint32_t(stream.triangle_setup.size());
 	}
 
+	if (resident_fb.valid && !keep_framebuffer_resident)
+	{
+		resolve_resident_framebuffer(*cmd);
+		cmd->barrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+		             VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT);
+	}
+
 	cmd->barrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
 	             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
 	             VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT);
@@ -1915,6 +2373,7 @@ void Renderer::begin_new_context()
 	stream.span_info_offsets.reset();
 	stream.span_info_jobs.reset();
 	stream.max_shaded_tiles = 0;
+	stream.num_span_lines = 0;
 
 	fb.deduced_height = 0;
 	fb.color_write_pending = false;
@@ -1923,9 +2382,10 @@ void Renderer::begin_new_context()
 	stream.tmem_upload_infos.clear();
 }
 
-void Renderer::flush_queues()
+void Renderer::flush_queues(bool keep_framebuffer_resident)
 {
-	if (stream.triangle_setup.empty() && stream.tmem_upload_infos.empty())
+	bool need_resolve = resident_fb.valid && !keep_framebuffer_resident;
+	if (stream.triangle_setup.empty() && stream.tmem_upload_infos.empty() && !need_resolve)
 		return;
 
 	auto &instance = buffer_instances[buffer_instance];
@@ -1937,7 +2397,7 @@ void Renderer::flush_queues()
 	}
 
 	instance.upload(*device, stream);
-	submit_render_pass();
+	submit_render_pass(keep_framebuffer_resident);
 	begin_new_context();
 }
 
@@ -1961,6 +2421,16 @@ bool Renderer::tmem_upload_needs_flush(uint32_t addr) const
 	// Not perfect, since TMEM upload could slice into framebuffer,
 	// but I doubt this will be an issue (famous last words ...)
 
+	if (resident_fb.valid)
+	{
+		// RDRAM is stale while the framebuffer is resident, regardless of what is pending in this batch.
+		uint32_t rdram_mask = rdram->get_create_info().size - 1;
+		uint32_t color_offset = (addr - resident_fb.color_addr) & rdram_mask;
+		uint32_t depth_offset = (addr - resident_fb.depth_addr) & rdram_mask;
+		if (color_offset < resident_fb.color_size || depth_offset < resident_fb.depth_size)
+			return true;
+	}
+
 	if (fb.color_write_pending)
 	{
 		uint32_t offset = (addr - fb.addr) & (rdram->get_create_info().size - 1);
@@ -2268,7 +2738,7 @@ void Renderer::load_tile(uint32_t tile, const LoadTileInfo &info)
 
 	stream.tmem_upload_infos.push_back(upload);
 	if (stream.tmem_upload_infos.size() + 1 >= Limits::MaxTMEMInstances)
-		flush_queues();
+		flush_queues(true);
 }
 
 void Renderer::set_blend_color(uint32_t color)
@@ -99,8 +99,24 @@ public:
 	void flush();
 	Vulkan::Fence flush_and_signal();
 
+	// Selects the tile size used for binning and shading. Supported sizes are 8x8, 16x8 and 16x16.
+	bool set_raster_tile_size(unsigned width, unsigned height);
+	// Replays a short synthetic workload with every supported tile size and keeps the fastest one.
+	// RDRAM written by the workload is restored afterwards.
+	void calibrate_raster_tile_size();
+	bool raster_tile_size_calibration_requested() const;
+
 	int resolve_shader_define(const char *name, const char *define) const;
 
+	// RDRAM ranges written by render passes since last clear, used to tell if a scanout is stale.
+	struct RDRAMRange
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+	const std::vector<RDRAMRange> &get_written_rdram_ranges() const;
+	void clear_written_rdram_ranges();
+
 private:
 	Vulkan::Device *device = nullptr;
 	Vulkan::Buffer *rdram = nullptr;
@@ -112,6 +128,13 @@ private:
 	void init_blender_lut();
 	void init_buffers();
 
+	struct
+	{
+		unsigned width = ImplementationConstants::TileWidth;
+		unsigned height = ImplementationConstants::TileHeight;
+		unsigned max_tile_instances = Limits::MaxTileInstances;
+	} raster_tile;
+
 	struct
 	{
 		uint32_t addr = 0;
@@ -143,6 +166,7 @@ private:
 
 		std::vector<UploadInfo> tmem_upload_infos;
 		unsigned max_shaded_tiles = 0;
+		unsigned num_span_lines = 0;
 	} stream;
 
 	TileInfo tiles[Limits::MaxNumTiles];
@@ -154,6 +178,9 @@ private:
 	Vulkan::BufferHandle tile_binning_buffer_prepass;
 	Vulkan::BufferHandle tile_binning_buffer;
 	Vulkan::BufferHandle tile_binning_buffer_coarse;
+	Vulkan::BufferHandle tile_binning_buffer_segment;
+	Vulkan::BufferHandle active_tile_list;
+	Vulkan::BufferHandle active_tile_indirect_buffer;
 
 	Vulkan::BufferHandle indirect_dispatch_buffer;
 	Vulkan::BufferHandle tile_work_list;
@@ -163,6 +190,30 @@ private:
 	Vulkan::BufferHandle per_tile_shaded_shaded_alpha;
 	Vulkan::BufferHandle per_tile_shaded_coverage;
 
+	// Device local mirror of RDRAM. The current color and depth images are kept resident here
+	// across render passes, and only resolved back to RDRAM on hazards.
+	// Only allocated if caps.resident_framebuffer is set.
+	Vulkan::BufferHandle resident_rdram;
+	struct
+	{
+		bool valid = false;
+		uint32_t color_addr = 0;
+		uint32_t depth_addr = 0;
+		uint32_t color_size = 0;
+		uint32_t depth_size = 0;
+	} resident_fb;
+
+	struct ByteRange
+	{
+		uint32_t begin;
+		uint32_t end;
+	};
+	// Writes the union of a and b as at most two disjoint, sorted ranges. Returns the number of ranges.
+	static unsigned merge_byte_ranges(ByteRange *ranges, const ByteRange &a, const ByteRange &b);
+
+	bool begin_resident_framebuffer(Vulkan::CommandBuffer &cmd);
+	void resolve_resident_framebuffer(Vulkan::CommandBuffer &cmd);
+
 	struct MappedBuffer
 	{
 		Vulkan::BufferHandle buffer;
@@ -230,8 +281,12 @@ private:
 
 	bool tmem_upload_needs_flush(uint32_t addr) const;
 
-	void flush_queues();
-	void submit_render_pass();
+	enum { MaxWrittenRDRAMRanges = 64 };
+	std::vector<RDRAMRange> written_rdram_ranges;
+	void add_written_rdram_range(uint32_t offset, uint32_t size);
+
+	void flush_queues(bool keep_framebuffer_resident = false);
+	void submit_render_pass(bool keep_framebuffer_resident);
 	void begin_new_context();
 	bool need_flush() const;
 	void update_tmem_instances(Vulkan::CommandBuffer &cmd);
@@ -273,6 +328,8 @@ private:
 		bool supports_small_integer_arithmetic = false;
 		bool subgroup_tile_binning_prepass = false;
 		bool subgroup_tile_binning = false;
+		bool calibrate_raster_tile_size = false;
+		bool resident_framebuffer = true;
 	} caps;
 
 	struct PipelineExecutor
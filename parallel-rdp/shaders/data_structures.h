@@ -139,7 +139,7 @@ struct SpanInfoOffsetsMem
 	int offset;
 	int ylo;
 	int yhi;
-	int padding;
+	int num_lines;
 };
 #define SpanInfoOffsets SpanInfoOffsetsMem
 
@@ -126,6 +126,16 @@ layout(set = 1, binding = 12, std430) readonly buffer TileBinningCoarse
 	uint elems[];
 } tile_binning_coarse;
 
+layout(set = 1, binding = 13, std430) buffer TileBinningSegment
+{
+	uint elems[];
+} tile_binning_segment;
+
+layout(set = 1, binding = 14, std430) readonly buffer ActiveTiles
+{
+	uint elems[];
+} active_tiles;
+
 layout(set = 2, binding = 0, std140) uniform GlobalConstants
 {
 	GlobalFBInfo fb_info;
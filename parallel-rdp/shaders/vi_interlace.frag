@@ -0,0 +1,50 @@
+#version 450
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#extension GL_EXT_samplerless_texture_functions : require
+
+// Reconstructs a full frame from an interlaced field.
+// Lines of the current field are taken as-is. The other lines come either from the previous field (weave),
+// or by repeating the closest line of the current field above (bob).
+
+layout(set = 0, binding = 0) uniform mediump texture2D uCurrentField;
+layout(set = 0, binding = 1) uniform mediump texture2D uPreviousField;
+layout(location = 0) out vec4 FragColor;
+
+layout(push_constant) uniform Registers
+{
+    int field;
+    int weave;
+} registers;
+
+void main()
+{
+    ivec2 pix = ivec2(gl_FragCoord.xy);
+    int line = pix.y >> 1;
+
+    if ((pix.y & 1) == registers.field)
+        FragColor = texelFetch(uCurrentField, ivec2(pix.x, line), 0);
+    else if (registers.weave != 0)
+        FragColor = texelFetch(uPreviousField, ivec2(pix.x, line), 0);
+    else
+        FragColor = texelFetch(uCurrentField, ivec2(pix.x, max((pix.y - registers.field) >> 1, 0)), 0);
+}
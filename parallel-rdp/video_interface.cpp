@@ -40,6 +40,17 @@ void VideoInterface::set_device(Vulkan::Device *device_)
 		filter_debug_channel_x = strtol(env, nullptr, 0);
 	if (const char *env = getenv("VI_DEBUG_Y"))
 		filter_debug_channel_y = strtol(env, nullptr, 0);
+	if (const char *env = getenv("VI_FUSED"))
+		fused_scanout = strtol(env, nullptr, 0) != 0;
+	if (const char *env = getenv("VI_INTERLACE"))
+	{
+		if (strcmp(env, "weave") == 0)
+			interlace_mode = VIInterlaceMode::Weave;
+		else if (strcmp(env, "bob") == 0)
+			interlace_mode = VIInterlaceMode::Bob;
+		else
+			interlace_mode = VIInterlaceMode::Off;
+	}
 }
 
 int VideoInterface::resolve_shader_define(const char *name, const char *define) const
@@ -119,7 +130,76 @@ void VideoInterface::set_shader_bank(const ShaderBank *bank)
 	shader_bank = bank;
 }
 
+void VideoInterface::set_fused_scanout(bool enable)
+{
+	fused_scanout = enable;
+}
+
+void VideoInterface::set_scanout_reuse(bool enable)
+{
+	scanout_reuse = enable;
+	previous_scanout = {};
+}
+
+void VideoInterface::set_interlace_mode(VIInterlaceMode mode)
+{
+	interlace_mode = mode;
+	previous_field = {};
+	previous_scanout.image.reset();
+}
+
+void VideoInterface::notify_rdram_write(uint32_t offset, uint32_t size)
+{
+	uint64_t begin = offset;
+	uint64_t end = begin + size;
+	if (begin < previous_scanout.vram_end && end > previous_scanout.vram_begin)
+		previous_scanout.dirty = true;
+}
+
 Vulkan::ImageHandle VideoInterface::scanout(VkImageLayout target_layout)
+{
+	if (scanout_reuse && previous_scanout.image && !previous_scanout.dirty &&
+	    previous_scanout.layout == target_layout &&
+	    memcmp(previous_scanout.vi_registers, vi_registers, sizeof(vi_registers)) == 0)
+	{
+		frame_count++;
+		return previous_scanout.image;
+	}
+
+	previous_scanout.image.reset();
+	previous_scanout.vram_begin = 0;
+	previous_scanout.vram_end = 0;
+	previous_scanout.dirty = true;
+
+	uint32_t control = vi_registers[unsigned(VIRegister::Control)];
+	bool interlaced = interlace_mode != VIInterlaceMode::Off &&
+	                  (control & VI_CONTROL_SERRATE_BIT) != 0 &&
+	                  (control & VI_CONTROL_TYPE_RGBA5551_BIT) != 0;
+
+	Vulkan::ImageHandle image;
+	if (interlaced)
+	{
+		image = scanout_uncached(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		if (image)
+			image = scanout_interlaced(std::move(image), target_layout);
+	}
+	else
+	{
+		previous_field = {};
+		image = scanout_uncached(target_layout);
+	}
+
+	if (scanout_reuse && image)
+	{
+		previous_scanout.image = image;
+		previous_scanout.layout = target_layout;
+		memcpy(previous_scanout.vi_registers, vi_registers, sizeof(vi_registers));
+	}
+
+	return image;
+}
+
+Vulkan::ImageHandle VideoInterface::scanout_uncached(VkImageLayout target_layout)
 {
 	Vulkan::ImageHandle scanout;
 
@@ -203,6 +283,47 @@ Vulkan::ImageHandle VideoInterface::scanout(VkImageLayout target_layout)
 
 	bool degenerate = h_res <= 0 || v_res <= 0;
 
+	// Gamma dither noise changes every frame, and repeated blank frames are not scanned out at all,
+	// so those cannot be reused. Otherwise, remember which VRAM we might read from, including filter borders.
+	if (!degenerate && !is_blank && (status & VI_CONTROL_GAMMA_DITHER_ENABLE_BIT) == 0)
+	{
+		int bytes_per_pixel = (status & VI_CONTROL_TYPE_MASK) == VI_CONTROL_TYPE_RGBA8888_BIT ? 4 : 2;
+		int max_x = (x_start + h_res * x_add) >> 10;
+		int max_y = (y_start + v_res * y_add) >> 10;
+		int64_t begin = int64_t(vi_offset) - int64_t(2 * vi_width + 3) * bytes_per_pixel;
+		int64_t end = int64_t(vi_offset) + int64_t((max_y + 3) * vi_width + max_x + 8) * bytes_per_pixel;
+
+		// Wrapping around RDRAM is possible, but not worth tracking.
+		if (begin >= 0 && end <= int64_t(rdram->get_create_info().size))
+		{
+			previous_scanout.vram_begin = uint64_t(begin);
+			previous_scanout.vram_end = uint64_t(end);
+			previous_scanout.dirty = false;
+		}
+	}
+
+	// Common for 2D and menu screens. Without AA, dither filter and divot, the fetch and divot passes
+	// pass pixels straight through, and with 1:1 scaling there is nothing to interpolate either,
+	// so we can copy VRAM straight to the output.
+	// The direct path does not emit to the VI debug channel, so take the filter path when debugging.
+	bool direct = !debug_channel &&
+	              (status & VI_CONTROL_AA_MODE_MASK) == VI_CONTROL_AA_MODE_RESAMP_REPLICATE_BIT &&
+	              (status & VI_CONTROL_DITHER_FILTER_ENABLE_BIT) == 0 &&
+	              !divot && x_add == 1024 && y_add == 1024;
+
+	// The fused path keeps the filter neighborhood of a workgroup in shared memory,
+	// which only fits if we're not downscaling more than 2:1.
+	if (direct || (fused_scanout && x_add <= 2048 && y_add <= 2048))
+	{
+		scanout = scanout_compute(target_layout, status, vi_offset, vi_width,
+		                          x_start, y_start, x_add, y_add,
+		                          h_start, v_start, h_res, v_res,
+		                          left_clamp, right_clamp, is_pal, degenerate,
+		                          direct);
+		frame_count++;
+		return scanout;
+	}
+
 	// First we copy data out of VRAM into a texture which we will then perform our post-AA on.
 	// We do this on the async queue so we don't have to stall async queue on graphics work to deal with WAR hazards.
 	// After the copy, we can immediately begin rendering new frames while we do post in parallel.
@@ -555,4 +676,186 @@ Vulkan::ImageHandle VideoInterface::scanout(VkImageLayout target_layout)
 	return scanout;
 }
 
+Vulkan::ImageHandle VideoInterface::scanout_compute(VkImageLayout target_layout, int status, int vi_offset, int vi_width,
+                                                    int x_start, int y_start, int x_add, int y_add,
+                                                    int h_start, int v_start, int h_res, int v_res,
+                                                    bool left_clamp, bool right_clamp, bool is_pal, bool degenerate,
+                                                    bool direct)
+{
+	// Rendering work in next frame happens on the async queue, so read VRAM there to avoid WAR hazards,
+	// just like the VRAM extraction in the multi-pass path.
+	auto cmd = device->request_command_buffer(Vulkan::CommandBuffer::Type::AsyncCompute);
+
+	Vulkan::ImageCreateInfo rt_info = Vulkan::ImageCreateInfo::render_target(
+			640, (is_pal ? VI_V_RES_PAL : VI_V_RES_NTSC) >> 1, VK_FORMAT_R8G8B8A8_UNORM);
+	rt_info.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	rt_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	rt_info.misc = Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT |
+	               Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_GRAPHICS_BIT |
+	               Vulkan::IMAGE_MISC_CONCURRENT_QUEUE_ASYNC_COMPUTE_BIT;
+	auto scale_image = device->create_image(rt_info);
+
+	cmd->image_barrier(*scale_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+	                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+#ifdef PARALLEL_RDP_SHADER_DIR
+	cmd->set_program("rdp://vi_fused.comp");
+#else
+	cmd->set_program(shader_bank->vi_fused);
+#endif
+
+	cmd->set_storage_texture(0, 0, scale_image->get_view());
+	cmd->set_storage_buffer(0, 1, *rdram);
+	cmd->set_storage_buffer(0, 2, *hidden_rdram);
+	cmd->set_buffer_view(0, 3, *gamma_lut_view);
+
+	struct Push
+	{
+		uint32_t fb_offset;
+		uint32_t fb_width;
+		int32_t x_offset, y_offset;
+		int32_t h_offset, v_offset;
+		uint32_t x_add;
+		uint32_t y_add;
+		uint32_t frame_count;
+		int32_t rect_x, rect_y;
+		int32_t rect_width, rect_height;
+	} push = {};
+
+	if ((status & VI_CONTROL_TYPE_MASK) == VI_CONTROL_TYPE_RGBA8888_BIT)
+		push.fb_offset = vi_offset >> 2;
+	else
+		push.fb_offset = vi_offset >> 1;
+
+	push.fb_width = vi_width;
+	push.x_offset = x_start;
+	push.y_offset = y_start;
+	push.h_offset = h_start;
+	push.v_offset = v_start;
+	push.x_add = x_add;
+	push.y_add = y_add;
+	push.frame_count = frame_count;
+
+	// Same active area as the scissor in the multi-pass path.
+	if (!left_clamp)
+	{
+		h_start += 8;
+		h_res -= 8;
+	}
+
+	if (!right_clamp)
+		h_res -= 7;
+
+	if (!degenerate && h_res > 0 && v_res > 0)
+	{
+		push.rect_x = h_start;
+		push.rect_y = v_start;
+		push.rect_width = h_res;
+		push.rect_height = v_res;
+	}
+
+	cmd->set_specialization_constant_mask(15);
+	cmd->set_specialization_constant(0, uint32_t(rdram->get_create_info().size));
+	cmd->set_specialization_constant(1, status & (VI_CONTROL_TYPE_MASK |
+	                                              VI_CONTROL_AA_MODE_MASK |
+	                                              VI_CONTROL_DITHER_FILTER_ENABLE_BIT |
+	                                              VI_CONTROL_DIVOT_ENABLE_BIT |
+	                                              VI_CONTROL_GAMMA_ENABLE_BIT |
+	                                              VI_CONTROL_GAMMA_DITHER_ENABLE_BIT));
+	cmd->set_specialization_constant(2, uint32_t(y_add < 1024));
+	cmd->set_specialization_constant(3, uint32_t(direct));
+
+	cmd->push_constants(&push, 0, sizeof(push));
+	cmd->dispatch((scale_image->get_width() + 7) / 8, (scale_image->get_height() + 7) / 8, 1);
+
+	// The semaphore takes care of memory visibility towards the graphics queue.
+	VkPipelineStageFlags wait_stages;
+	if (target_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+		wait_stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	else
+		wait_stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+	cmd->image_barrier(*scale_image, VK_IMAGE_LAYOUT_GENERAL, target_layout,
+	                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+	                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+	Vulkan::Semaphore sem;
+	device->submit(cmd, nullptr, 1, &sem);
+	device->add_wait_semaphore(Vulkan::CommandBuffer::Type::Generic, std::move(sem), wait_stages, true);
+	return scale_image;
+}
+
+Vulkan::ImageHandle VideoInterface::scanout_interlaced(Vulkan::ImageHandle field_image, VkImageLayout target_layout)
+{
+	// Same field selection as Angrylion when the emulator drives VCurrentLine.
+	unsigned field = (vi_registers[unsigned(VIRegister::VCurrentLine)] & 1) ^ 1;
+
+	bool weave = interlace_mode == VIInterlaceMode::Weave &&
+	             previous_field.image &&
+	             previous_field.field != field &&
+	             previous_field.image->get_width() == field_image->get_width() &&
+	             previous_field.image->get_height() == field_image->get_height();
+
+	auto cmd = device->request_command_buffer();
+
+	Vulkan::ImageCreateInfo rt_info = Vulkan::ImageCreateInfo::render_target(
+			field_image->get_width(), field_image->get_height() * 2, VK_FORMAT_R8G8B8A8_UNORM);
+	rt_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	rt_info.initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	rt_info.misc = Vulkan::IMAGE_MISC_MUTABLE_SRGB_BIT;
+	auto frame_image = device->create_image(rt_info);
+
+	Vulkan::RenderPassInfo rp;
+	rp.color_attachments[0] = &frame_image->get_view();
+	rp.num_color_attachments = 1;
+	rp.store_attachments = 1;
+
+	cmd->image_barrier(*frame_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+	                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+	cmd->begin_render_pass(rp);
+	cmd->set_opaque_state();
+
+#ifdef PARALLEL_RDP_SHADER_DIR
+	cmd->set_program("rdp://fullscreen.vert", "rdp://vi_interlace.frag");
+#else
+	cmd->set_program(device->request_program(shader_bank->fullscreen, shader_bank->vi_interlace));
+#endif
+
+	struct Push
+	{
+		uint32_t field;
+		uint32_t weave;
+	} push = {};
+	push.field = field;
+	push.weave = uint32_t(weave);
+	cmd->push_constants(&push, 0, sizeof(push));
+
+	cmd->set_texture(0, 0, field_image->get_view());
+	cmd->set_texture(0, 1, weave ? previous_field.image->get_view() : field_image->get_view());
+	cmd->draw(3);
+	cmd->end_render_pass();
+
+	if (target_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	{
+		cmd->image_barrier(*frame_image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+	else if (target_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+	{
+		cmd->image_barrier(*frame_image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	}
+
+	device->submit(cmd);
+
+	previous_field.image = std::move(field_image);
+	previous_field.field = field;
+	return frame_image;
+}
+
 }
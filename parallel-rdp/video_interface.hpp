@@ -41,6 +41,18 @@ public:
 	Vulkan::ImageHandle scanout(VkImageLayout target_layout);
 	void set_shader_bank(const ShaderBank *bank);
 
+	// Performs VRAM fetch, AA, divot and scale in a single compute dispatch where possible.
+	void set_fused_scanout(bool enable);
+
+	// If enabled, scanout returns the previous image as long as VI registers are unchanged,
+	// and no RDRAM the previous scanout read from has been written since.
+	// All RDRAM writes must be reported through notify_rdram_write() for this to work.
+	void set_scanout_reuse(bool enable);
+	void notify_rdram_write(uint32_t offset, uint32_t size);
+
+	// Controls how fields are combined when the VI is in serrate (interlaced) mode.
+	void set_interlace_mode(VIInterlaceMode mode);
+
 private:
 	Vulkan::Device *device = nullptr;
 	uint32_t vi_registers[unsigned(VIRegister::Count)] = {};
@@ -51,7 +63,15 @@ private:
 	const ShaderBank *shader_bank = nullptr;
 
 	void init_gamma_table();
+	Vulkan::ImageHandle scanout_uncached(VkImageLayout target_layout);
+	Vulkan::ImageHandle scanout_interlaced(Vulkan::ImageHandle field_image, VkImageLayout target_layout);
+	Vulkan::ImageHandle scanout_compute(VkImageLayout target_layout, int status, int vi_offset, int vi_width,
+	                                    int x_start, int y_start, int x_add, int y_add,
+	                                    int h_start, int v_start, int h_res, int v_res,
+	                                    bool left_clamp, bool right_clamp, bool is_pal, bool degenerate,
+	                                    bool direct);
 	bool previous_frame_blank = false;
+	bool fused_scanout = false;
 	bool debug_channel = false;
 	int filter_debug_channel_x = -1;
 	int filter_debug_channel_y = -1;
@@ -61,5 +81,23 @@ private:
 	             uint32_t num_words, const Vulkan::DebugChannelInterface::Word *words) override;
 
 	uint32_t frame_count = 0;
+
+	struct
+	{
+		Vulkan::ImageHandle image;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		uint32_t vi_registers[unsigned(VIRegister::Count)] = {};
+		uint64_t vram_begin = 0;
+		uint64_t vram_end = 0;
+		bool dirty = true;
+	} previous_scanout;
+	bool scanout_reuse = false;
+
+	VIInterlaceMode interlace_mode = VIInterlaceMode::Off;
+	struct
+	{
+		Vulkan::ImageHandle image;
+		unsigned field = 0;
+	} previous_field;
 };
 }
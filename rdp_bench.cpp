@@ -0,0 +1,513 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump.hpp"
+#include "replayer_driver.hpp"
+#include "cli_parser.hpp"
+#include "context.hpp"
+#include "device.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace RDP;
+
+// CPU time consumed by all threads of the process, so work done on the CommandProcessor ring thread
+// and Angrylion workers is included, while time spent blocked on the GPU is not.
+static uint64_t get_process_cpu_time_nsecs()
+{
+#ifdef _WIN32
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+		return 0;
+	uint64_t kernel = (uint64_t(kernel_time.dwHighDateTime) << 32) | kernel_time.dwLowDateTime;
+	uint64_t user = (uint64_t(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+	return (kernel + user) * 100;
+#else
+	timespec ts;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+#endif
+}
+
+struct BenchInterface : ReplayerEventInterface
+{
+	void update_screen(const void *data, unsigned, unsigned, unsigned) override
+	{
+		if (data)
+			vi_count++;
+	}
+
+	void notify_command(Op, uint32_t, const uint32_t *) override {}
+	void message(MessageType, const char *) override {}
+	void eof() override {}
+	void set_context_index(unsigned) override {}
+	void signal_complete() override {}
+
+	unsigned vi_count = 0;
+};
+
+struct FrameTiming
+{
+	// Wall time spent inside driver calls, which includes waiting for the GPU at sync points.
+	uint64_t driver_ns;
+	// Process-wide CPU time over the whole frame, including the renderer's own threads.
+	uint64_t process_cpu_ns;
+	uint64_t wall_ns;
+};
+
+struct GPUInterval
+{
+	std::string tag;
+	double total_time;
+	double time_per_frame_context;
+	uint64_t count;
+};
+
+struct IterationResult
+{
+	double seconds;
+	unsigned vi_count;
+	std::vector<FrameTiming> frames;
+	std::vector<GPUInterval> gpu_intervals;
+};
+
+// Sits between the player and the driver, and measures the wall time spent inside the driver for every frame.
+// Sync points are forwarded as-is, so the driver waits for them just like it would in an emulator,
+// and that wait is part of the measured time. It is not a measure of CPU time alone.
+class TimingListener : public CommandListenerInterface
+{
+public:
+	TimingListener(ReplayerDriver &driver_, Vulkan::Device *device_)
+		: driver(driver_), device(device_)
+	{
+	}
+
+	void begin_iteration()
+	{
+		frames.clear();
+		driver_ns = 0;
+		frame_start = Util::get_current_time_nsecs();
+		frame_start_cpu = get_process_cpu_time_nsecs();
+	}
+
+	void set_vi_register(VIRegister reg, uint32_t value) override
+	{
+		timed([&]() { driver.set_vi_register(reg, value); });
+	}
+
+	void signal_complete() override
+	{
+		timed([&]() { driver.signal_complete(); });
+	}
+
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override
+	{
+		timed([&]() { driver.command(cmd_id, num_words, words); });
+	}
+
+	void end_frame() override
+	{
+		timed([&]() { driver.end_frame(); });
+
+		auto current_time = Util::get_current_time_nsecs();
+		auto current_cpu_time = get_process_cpu_time_nsecs();
+		frames.push_back({ driver_ns, current_cpu_time - frame_start_cpu, uint64_t(current_time - frame_start) });
+		driver_ns = 0;
+		frame_start = current_time;
+		frame_start_cpu = current_cpu_time;
+
+		if (device)
+			device->next_frame_context();
+	}
+
+	void eof() override
+	{
+		driver.eof();
+	}
+
+	void update_rdram(const void *data, size_t size, size_t offset) override
+	{
+		timed([&]() { driver.update_rdram(data, size, offset); });
+	}
+
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override
+	{
+		timed([&]() { driver.update_hidden_rdram(data, size, offset); });
+	}
+
+	std::vector<FrameTiming> frames;
+
+private:
+	ReplayerDriver &driver;
+	Vulkan::Device *device;
+	uint64_t driver_ns = 0;
+	int64_t frame_start = 0;
+	uint64_t frame_start_cpu = 0;
+
+	template <typename Func>
+	void timed(const Func &func)
+	{
+		auto start_time = Util::get_current_time_nsecs();
+		func();
+		driver_ns += uint64_t(Util::get_current_time_nsecs() - start_time);
+	}
+};
+
+static void print_help()
+{
+	LOGE("Usage: rdp-bench\n"
+	     "\t<Path to dump>\n"
+	     "\t[--iterations <count>]\n"
+	     "\t[--preload]\n"
+	     "\t[--angrylion]\n"
+	     "\t[--angrylion-parallel]\n"
+	     "\t[--angrylion-workers <count>]\n"
+	     "\t[--angrylion-band-lines <count>]\n"
+	     "\t[--csv <path>]\n"
+	     "\t[--json <path>]\n"
+	);
+}
+
+template <typename Player>
+static bool run_iterations(Player &player, ReplayerDriver &driver, BenchInterface &iface, Vulkan::Device *device,
+                           bool gpu_timestamps, unsigned iterations, std::vector<IterationResult> &results)
+{
+	TimingListener timing(driver, device);
+	player.set_command_interface(&timing);
+
+	for (unsigned i = 0; i < iterations; i++)
+	{
+		if (!player.rewind())
+		{
+			LOGE("Failed to rewind dump.\n");
+			return false;
+		}
+
+		if (device)
+			device->timestamp_log_reset();
+
+		timing.begin_iteration();
+		iface.vi_count = 0;
+		auto start_time = Util::get_current_time_nsecs();
+		while (player.iterate())
+		{
+		}
+		driver.idle();
+		auto end_time = Util::get_current_time_nsecs();
+
+		IterationResult result;
+		result.seconds = double(end_time - start_time) * 1e-9;
+		result.vi_count = iface.vi_count;
+		result.frames = std::move(timing.frames);
+
+		uint64_t total_driver_ns = 0;
+		uint64_t total_cpu_ns = 0;
+		for (auto &frame : result.frames)
+		{
+			total_driver_ns += frame.driver_ns;
+			total_cpu_ns += frame.process_cpu_ns;
+		}
+		unsigned frames = unsigned(result.frames.size());
+
+		LOGI("Iteration %u: %u frames in %.3f s, %.2f frames/s, %.2f VI/s, "
+		     "%.3f ms in driver / frame (wall time, includes sync waits), %.3f ms process CPU / frame.\n",
+		     i, frames, result.seconds, result.seconds > 0.0 ? double(frames) / result.seconds : 0.0,
+		     result.seconds > 0.0 ? double(result.vi_count) / result.seconds : 0.0,
+		     frames ? double(total_driver_ns) * 1e-6 / double(frames) : 0.0,
+		     frames ? double(total_cpu_ns) * 1e-6 / double(frames) : 0.0);
+
+		if (device)
+		{
+			// Timestamps are only resolved once their frame context has completed.
+			device->wait_idle();
+			device->timestamp_log([&](const std::string &tag, const Vulkan::TimestampIntervalReport &report) {
+				result.gpu_intervals.push_back({ tag, report.total_time, report.time_per_frame_context,
+				                                 report.total_accumulations });
+			});
+
+			for (auto &interval : result.gpu_intervals)
+			{
+				LOGI("  %s: %.3f ms total, %.3f ms / frame context, %llu intervals.\n",
+				     interval.tag.c_str(), interval.total_time * 1e3, interval.time_per_frame_context * 1e3,
+				     static_cast<unsigned long long>(interval.count));
+			}
+
+			if (gpu_timestamps && frames && result.gpu_intervals.empty())
+			{
+				LOGE("GPU timestamps were enabled, but no GPU intervals were collected. "
+				     "Set PARALLEL_RDP_BENCH=0 to benchmark without GPU timings.\n");
+				return false;
+			}
+		}
+
+		results.push_back(std::move(result));
+	}
+
+	return true;
+}
+
+static bool write_csv(const std::string &path, const std::vector<IterationResult> &results)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "iteration,frame,driver_wall_ms,process_cpu_ms,wall_ms\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		for (size_t frame = 0; frame < results[i].frames.size(); frame++)
+		{
+			auto &timing = results[i].frames[frame];
+			fprintf(file, "%u,%u,%.6f,%.6f,%.6f\n", unsigned(i), unsigned(frame),
+			        double(timing.driver_ns) * 1e-6, double(timing.process_cpu_ns) * 1e-6,
+			        double(timing.wall_ns) * 1e-6);
+		}
+	}
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+	return success;
+}
+
+static std::string escape_json(const std::string &str)
+{
+	std::string escaped;
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+	return escaped;
+}
+
+static bool write_json(const std::string &path, const std::string &dump_path, const char *driver_name,
+                       const std::vector<IterationResult> &results)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fprintf(file, "{\n\t\"dump\": \"%s\",\n\t\"driver\": \"%s\",\n\t\"iterations\": [\n",
+	        escape_json(dump_path).c_str(), driver_name);
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		auto &result = results[i];
+		uint64_t total_driver_ns = 0;
+		uint64_t total_cpu_ns = 0;
+		for (auto &frame : result.frames)
+		{
+			total_driver_ns += frame.driver_ns;
+			total_cpu_ns += frame.process_cpu_ns;
+		}
+
+		fprintf(file, "\t\t{\n");
+		fprintf(file, "\t\t\t\"frames\": %u,\n", unsigned(result.frames.size()));
+		fprintf(file, "\t\t\t\"seconds\": %.6f,\n", result.seconds);
+		fprintf(file, "\t\t\t\"frames_per_second\": %.3f,\n",
+		        result.seconds > 0.0 ? double(result.frames.size()) / result.seconds : 0.0);
+		fprintf(file, "\t\t\t\"vi_count\": %u,\n", result.vi_count);
+		fprintf(file, "\t\t\t\"vi_per_second\": %.3f,\n",
+		        result.seconds > 0.0 ? double(result.vi_count) / result.seconds : 0.0);
+		fprintf(file, "\t\t\t\"driver_wall_ms\": %.6f,\n", double(total_driver_ns) * 1e-6);
+		fprintf(file, "\t\t\t\"process_cpu_ms\": %.6f,\n", double(total_cpu_ns) * 1e-6);
+
+		fprintf(file, "\t\t\t\"gpu_intervals\": {");
+		for (size_t j = 0; j < result.gpu_intervals.size(); j++)
+		{
+			auto &interval = result.gpu_intervals[j];
+			fprintf(file, "%s\n\t\t\t\t\"%s\": { \"total_ms\": %.6f, \"ms_per_frame_context\": %.6f, \"count\": %llu }",
+			        j ? "," : "", escape_json(interval.tag).c_str(),
+			        interval.total_time * 1e3, interval.time_per_frame_context * 1e3,
+			        static_cast<unsigned long long>(interval.count));
+		}
+		fprintf(file, "%s},\n", result.gpu_intervals.empty() ? "" : "\n\t\t\t");
+
+		fprintf(file, "\t\t\t\"frame_timings\": [");
+		for (size_t frame = 0; frame < result.frames.size(); frame++)
+		{
+			auto &timing = result.frames[frame];
+			fprintf(file, "%s\n\t\t\t\t{ \"driver_wall_ms\": %.6f, \"process_cpu_ms\": %.6f, \"wall_ms\": %.6f }",
+			        frame ? "," : "", double(timing.driver_ns) * 1e-6, double(timing.process_cpu_ns) * 1e-6,
+			        double(timing.wall_ns) * 1e-6);
+		}
+		fprintf(file, "%s]\n", result.frames.empty() ? "" : "\n\t\t\t");
+		fprintf(file, "\t\t}%s\n", i + 1 < results.size() ? "," : "");
+	}
+
+	fprintf(file, "\t]\n}\n");
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+	return success;
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	std::string path;
+	std::string csv_path;
+	std::string json_path;
+	unsigned iterations = 1;
+	bool preload = false;
+	bool angrylion = false;
+	AngrylionConfig angrylion_config;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--iterations", [&](Util::CLIParser &parser) { iterations = parser.next_uint(); });
+	cbs.add("--preload", [&](Util::CLIParser &) { preload = true; });
+	cbs.add("--angrylion", [&](Util::CLIParser &) { angrylion = true; });
+	cbs.add("--angrylion-parallel", [&](Util::CLIParser &) { angrylion = true; angrylion_config.parallel = true; });
+	cbs.add("--angrylion-workers", [&](Util::CLIParser &parser) {
+		angrylion = true;
+		angrylion_config.parallel = true;
+		angrylion_config.num_workers = parser.next_uint();
+	});
+	cbs.add("--angrylion-band-lines", [&](Util::CLIParser &parser) {
+		angrylion = true;
+		angrylion_config.parallel = true;
+		angrylion_config.band_lines = parser.next_uint();
+	});
+	cbs.add("--csv", [&](Util::CLIParser &parser) { csv_path = parser.next_string(); });
+	cbs.add("--json", [&](Util::CLIParser &parser) { json_path = parser.next_string(); });
+	cbs.default_handler = [&](const char *arg) { path = arg; };
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	DumpPlayer player;
+	if (!player.load_dump(path.c_str()))
+	{
+		LOGE("Failed to load dump: %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// Decode everything up front, so iterations only measure rendering.
+	PreloadedDump preloaded;
+	if (preload)
+	{
+		auto start_time = Util::get_current_time_nsecs();
+		if (!preloaded.load(player))
+		{
+			LOGE("Failed to preload dump: %s\n", path.c_str());
+			return EXIT_FAILURE;
+		}
+		LOGI("Preloaded dump in %.3f s.\n", double(Util::get_current_time_nsecs() - start_time) * 1e-9);
+	}
+
+	CommandInterface &command_interface = preload ? static_cast<CommandInterface &>(preloaded) : player;
+
+	// Angrylion does not need a Vulkan device at all.
+	std::unique_ptr<Vulkan::Context> context;
+	std::unique_ptr<Vulkan::Device> device;
+	bool gpu_timestamps = false;
+	if (!angrylion)
+	{
+		// The renderer only registers GPU time intervals when PARALLEL_RDP_BENCH is set at device creation.
+		// An explicit value is respected, e.g. PARALLEL_RDP_BENCH=0 to measure without timestamp queries.
+		if (!getenv("PARALLEL_RDP_BENCH"))
+		{
+#ifdef _WIN32
+			_putenv_s("PARALLEL_RDP_BENCH", "1");
+#else
+			setenv("PARALLEL_RDP_BENCH", "1", 1);
+#endif
+		}
+		gpu_timestamps = strtol(getenv("PARALLEL_RDP_BENCH"), nullptr, 0) > 0;
+
+		if (!Vulkan::Context::init_loader(nullptr))
+		{
+			LOGE("Failed to init Vulkan loader.\n");
+			return EXIT_FAILURE;
+		}
+
+		context.reset(new Vulkan::Context);
+		if (!context->init_instance_and_device(nullptr, 0, nullptr, 0, Vulkan::CONTEXT_CREATION_DISABLE_BINDLESS_BIT))
+		{
+			LOGE("Failed to create Vulkan context.\n");
+			return EXIT_FAILURE;
+		}
+
+		device.reset(new Vulkan::Device);
+		device->set_context(*context);
+	}
+
+	BenchInterface iface;
+	std::unique_ptr<ReplayerDriver> driver;
+	if (angrylion)
+		driver = create_replayer_driver_angrylion(command_interface, iface, angrylion_config);
+	else
+		driver = create_replayer_driver_parallel(*device, command_interface, iface);
+
+	std::vector<IterationResult> results;
+	bool success;
+	if (preload)
+		success = run_iterations(preloaded, *driver, iface, device.get(), gpu_timestamps, iterations, results);
+	else
+		success = run_iterations(player, *driver, iface, device.get(), gpu_timestamps, iterations, results);
+
+	driver.reset();
+	if (device)
+		device->wait_idle();
+
+	if (success && !csv_path.empty())
+		success = write_csv(csv_path, results);
+	if (success && !json_path.empty())
+		success = write_json(json_path, path,
+		                     angrylion ? (angrylion_config.parallel ? "angrylion-parallel" : "angrylion") : "parallel",
+		                     results);
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
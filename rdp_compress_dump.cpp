@@ -0,0 +1,97 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump.hpp"
+#include "cli_parser.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+
+using namespace RDP;
+
+static void print_help()
+{
+	LOGE("Usage: rdp-compress-dump\n"
+	     "\t<Path to dump>\n"
+	     "\t--output <Path to RDPDUMP3 dump>\n"
+	);
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	std::string path;
+	std::string output_path;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output", [&](Util::CLIParser &parser) { output_path = parser.next_string(); });
+	cbs.default_handler = [&](const char *arg) { path = arg; };
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (path.empty() || output_path.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	DumpPlayer player;
+	if (!player.load_dump(path.c_str()))
+	{
+		LOGE("Failed to load dump: %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	DumpWriter writer;
+	if (!writer.open(output_path.c_str(), player.get_rdram_size(), player.get_hidden_rdram_size()))
+	{
+		LOGE("Failed to open %s for writing.\n", output_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	player.set_command_interface(&writer);
+	while (player.iterate())
+	{
+	}
+
+	if (!writer.close())
+	{
+		LOGE("Failed to write %s.\n", output_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
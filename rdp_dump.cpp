@@ -21,6 +21,8 @@
  */
 
 #include "rdp_dump.hpp"
+#include "rdp_dump_compression.hpp"
+#include "filesystem.hpp"
 #include <string.h>
 #include <algorithm>
 
@@ -37,20 +39,53 @@ enum class Command : uint32_t
 	EndOfFile = 6,
 	UpdateDramFlush = 7,
 	UpdateHiddenDram = 8,
-	UpdateHiddenDramFlush = 9
+	UpdateHiddenDramFlush = 9,
+	// RDPDUMP3 only. Payload is XOR-ed into the current contents.
+	UpdateDramDelta = 10,
+	UpdateHiddenDramDelta = 11
 };
 
+// RDPDUMP3 blocks never split a record, and are at most this large unless a single record is larger.
+static constexpr size_t DumpBlockSize = 1024 * 1024;
+
+DumpPlayer::DumpPlayer()
+{
+}
+
+DumpPlayer::~DumpPlayer()
+{
+}
+
 bool DumpPlayer::load_dump(const char *path)
 {
-	file.reset(fopen(path, "rb"));
+	if (prefetched_block_data.valid())
+		prefetched_block_data.wait();
+	prefetched_block = SIZE_MAX;
+	blocks.clear();
+	frame_positions.clear();
+	snapshots.clear();
+	mapped = nullptr;
+	mapped_size = 0;
+
+	file = Granite::Global::filesystem()->open(path, Granite::FileMode::ReadOnly);
 	if (!file)
 		return false;
 
-	char header[8];
-	if (fread(header, 1, 8, file.get()) != 8)
+	mapped_size = file->get_size();
+	mapped = static_cast<const uint8_t *>(file->map());
+	if (!mapped)
+		return false;
+
+	stream = mapped;
+	stream_size = mapped_size;
+	read_offset = 0;
+
+	auto *header = read_data(8);
+	if (!header)
 		return false;
 
-	if (memcmp(header, "RDPDUMP2", 8) != 0)
+	bool compressed = memcmp(header, "RDPDUMP3", 8) == 0;
+	if (!compressed && memcmp(header, "RDPDUMP2", 8) != 0)
 		return false;
 
 	uint32_t rdram_size, hidden_dram_size;
@@ -64,19 +99,124 @@ bool DumpPlayer::load_dump(const char *path)
 
 	rdram_cache.resize(rdram_size);
 	rdram_hidden_cache.resize(hidden_dram_size);
+
+	if (compressed)
+	{
+		// Build the block index by walking the block headers.
+		uint32_t block_header[2];
+		while (auto *data = read_data(sizeof(block_header)))
+		{
+			memcpy(block_header, data, sizeof(block_header));
+			Block block = { read_offset, block_header[0], block_header[1] };
+			if (!read_data(block.compressed_size))
+				return false;
+			blocks.push_back(block);
+		}
+
+		if (read_offset != mapped_size)
+			return false;
+	}
+
+	return rewind();
+}
+
+std::vector<uint8_t> DumpPlayer::decompress_block(size_t index) const
+{
+	auto &block = blocks[index];
+	std::vector<uint8_t> data(block.size);
+
+	// Blocks which did not compress are stored as is.
+	if (block.compressed_size == block.size)
+		memcpy(data.data(), mapped + block.offset, block.size);
+	else if (!decompress_dump_block(mapped + block.offset, block.compressed_size, data.data(), block.size))
+		data.clear();
+
+	return data;
+}
+
+bool DumpPlayer::load_block(size_t index)
+{
+	if (index >= blocks.size())
+		return false;
+
+	if (index == current_block && stream == block_data.data() && block_data.size() == blocks[index].size)
+		return true;
+
+	if (prefetched_block == index)
+		block_data = prefetched_block_data.get();
+	else
+		block_data = decompress_block(index);
+
+	if (prefetched_block_data.valid())
+		prefetched_block_data.wait();
+	prefetched_block = SIZE_MAX;
+
+	if (block_data.size() != blocks[index].size)
+		return false;
+
+	current_block = index;
+	stream = block_data.data();
+	stream_size = block_data.size();
+	read_offset = 0;
+
+	if (index + 1 < blocks.size())
+	{
+		prefetched_block = index + 1;
+		prefetched_block_data = std::async(std::launch::async, [this, index]() {
+			return decompress_block(index + 1);
+		});
+	}
+
 	return true;
 }
 
-bool DumpPlayer::rewind()
+DumpPlayer::Position DumpPlayer::get_start_position() const
 {
-	if (fseek(file.get(), 16, SEEK_SET) == 0)
+	// RDPDUMP2 records follow the header directly.
+	return { 0, blocks.empty() ? size_t(16) : size_t(0) };
+}
+
+DumpPlayer::Position DumpPlayer::get_position() const
+{
+	return { current_block, read_offset };
+}
+
+bool DumpPlayer::set_position(const Position &position)
+{
+	if (blocks.empty())
 	{
-		std::fill(rdram_cache.begin(), rdram_cache.end(), 0);
-		std::fill(rdram_hidden_cache.begin(), rdram_hidden_cache.end(), 0);
+		if (position.offset > mapped_size)
+			return false;
+		read_offset = position.offset;
 		return true;
 	}
-	else
+
+	if (!load_block(position.block) || position.offset > stream_size)
 		return false;
+	read_offset = position.offset;
+	return true;
+}
+
+bool DumpPlayer::begin_record()
+{
+	// Records never straddle blocks, so move on to the next block once the current one is exhausted.
+	while (!blocks.empty() && read_offset == stream_size)
+		if (!load_block(current_block + 1))
+			return false;
+	return true;
+}
+
+bool DumpPlayer::rewind()
+{
+	if (!mapped)
+		return false;
+
+	if (!set_position(get_start_position()))
+		return false;
+
+	std::fill(rdram_cache.begin(), rdram_cache.end(), 0);
+	std::fill(rdram_hidden_cache.begin(), rdram_hidden_cache.end(), 0);
+	return true;
 }
 
 void DumpPlayer::set_command_interface(CommandListenerInterface *iface_)
@@ -84,10 +224,27 @@ void DumpPlayer::set_command_interface(CommandListenerInterface *iface_)
 	iface = iface_;
 }
 
+static bool apply_rdram_update(std::vector<uint8_t> &cache, const uint8_t *data, uint32_t offset, uint32_t size,
+                               bool delta)
+{
+	if (size_t(offset) + size > cache.size())
+		return false;
+
+	if (delta)
+	{
+		for (uint32_t i = 0; i < size; i++)
+			cache[offset + i] ^= data[i];
+	}
+	else
+		memcpy(cache.data() + offset, data, size);
+
+	return true;
+}
+
 bool DumpPlayer::iterate()
 {
 	uint32_t command_u32;
-	if (!read_word(command_u32))
+	if (!begin_record() || !read_word(command_u32))
 		return false;
 	auto command = static_cast<Command>(command_u32);
 
@@ -116,14 +273,23 @@ bool DumpPlayer::iterate()
 		if (!read_word(word_count))
 			return false;
 
-		command_buffer.resize(word_count);
-		if (word_count)
+		auto *data = read_data(word_count * sizeof(uint32_t));
+		if (!data)
+			return false;
+
+		// Odd sized RDRAM updates can leave the stream unaligned, in which case the words have to be copied.
+		const uint32_t *words;
+		if ((reinterpret_cast<uintptr_t>(data) & (alignof(uint32_t) - 1)) == 0)
+			words = reinterpret_cast<const uint32_t *>(data);
+		else
 		{
-			if (fread(command_buffer.data(), sizeof(uint32_t), word_count, file.get()) != word_count)
-				return false;
+			command_buffer.resize(word_count);
+			if (word_count)
+				memcpy(command_buffer.data(), data, word_count * sizeof(uint32_t));
+			words = command_buffer.data();
 		}
 
-		iface->command(static_cast<Op>(cmd_id), word_count, command_buffer.data());
+		iface->command(static_cast<Op>(cmd_id), word_count, words);
 		break;
 	}
 
@@ -136,57 +302,221 @@ bool DumpPlayer::iterate()
 		break;
 
 	case Command::UpdateDram:
+	case Command::UpdateDramDelta:
+	case Command::UpdateHiddenDram:
+	case Command::UpdateHiddenDramDelta:
 	{
+		bool hidden = command == Command::UpdateHiddenDram || command == Command::UpdateHiddenDramDelta;
+		bool delta = command == Command::UpdateDramDelta || command == Command::UpdateHiddenDramDelta;
+
 		uint32_t offset, size;
 		if (!read_word(offset) || !read_word(size))
 			return false;
 
-		if (offset + size > rdram_cache.size())
+		auto *data = read_data(size);
+		if (!data || !apply_rdram_update(hidden ? rdram_hidden_cache : rdram_cache, data, offset, size, delta))
 			return false;
+		break;
+	}
 
-		if (fread(rdram_cache.data() + offset, 1, size, file.get()) != size)
-			return false;
+	case Command::UpdateDramFlush:
+	{
+		iface->update_rdram(rdram_cache.data(), rdram_cache.size(), 0);
+		break;
+	}
 
+	case Command::UpdateHiddenDramFlush:
+	{
+		iface->update_hidden_rdram(rdram_hidden_cache.data(), rdram_hidden_cache.size(), 0);
 		break;
 	}
 
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+// Reads one record without dispatching it, only applying RDRAM updates.
+bool DumpPlayer::scan_record(uint32_t &command_u32, std::vector<uint8_t> &rdram, std::vector<uint8_t> &hidden_rdram)
+{
+	if (!begin_record() || !read_word(command_u32))
+		return false;
+	auto command = static_cast<Command>(command_u32);
+
+	switch (command)
+	{
+	case Command::EndOfFile:
+		return false;
+
+	case Command::SetVIRegister:
+		return read_data(2 * sizeof(uint32_t)) != nullptr;
+
+	case Command::RDPCommand:
+	{
+		uint32_t cmd_id, word_count;
+		if (!read_word(cmd_id) || !read_word(word_count))
+			return false;
+		return read_data(word_count * sizeof(uint32_t)) != nullptr;
+	}
+
+	case Command::EndFrame:
+	case Command::SignalComplete:
+	case Command::UpdateDramFlush:
+	case Command::UpdateHiddenDramFlush:
+		return true;
+
+	case Command::UpdateDram:
+	case Command::UpdateDramDelta:
 	case Command::UpdateHiddenDram:
+	case Command::UpdateHiddenDramDelta:
 	{
+		bool hidden = command == Command::UpdateHiddenDram || command == Command::UpdateHiddenDramDelta;
+		bool delta = command == Command::UpdateDramDelta || command == Command::UpdateHiddenDramDelta;
+
 		uint32_t offset, size;
 		if (!read_word(offset) || !read_word(size))
 			return false;
 
-		if (offset + size > rdram_hidden_cache.size())
-			return false;
+		auto *data = read_data(size);
+		return data && apply_rdram_update(hidden ? hidden_rdram : rdram, data, offset, size, delta);
+	}
 
-		if (fread(rdram_hidden_cache.data() + offset, 1, size, file.get()) != size)
-			return false;
+	default:
+		return false;
+	}
+}
 
-		break;
+static constexpr size_t SnapshotPageSize = 4096;
+
+bool DumpPlayer::build_index(unsigned snapshot_interval)
+{
+	if (!mapped)
+		return false;
+
+	Position current_position = get_position();
+	if (!set_position(get_start_position()))
+		return false;
+
+	frame_positions.clear();
+	snapshots.clear();
+	frame_positions.push_back(get_position());
+
+	std::vector<uint8_t> rdram(rdram_cache.size());
+	std::vector<uint8_t> hidden_rdram(rdram_hidden_cache.size());
+
+	// Contents as of the previous snapshot, so snapshots only need to keep the pages which changed.
+	std::vector<uint8_t> snapshot_rdram, snapshot_hidden_rdram;
+	if (snapshot_interval)
+	{
+		snapshot_rdram.resize(rdram.size());
+		snapshot_hidden_rdram.resize(hidden_rdram.size());
 	}
 
-	case Command::UpdateDramFlush:
+	const auto diff_pages = [](Snapshot &snapshot, std::vector<uint8_t> &previous, const std::vector<uint8_t> &current,
+	                           bool hidden) {
+		for (size_t page = 0; page < current.size(); page += SnapshotPageSize)
+		{
+			size_t page_size = std::min(SnapshotPageSize, current.size() - page);
+			if (memcmp(previous.data() + page, current.data() + page, page_size) == 0)
+				continue;
+
+			snapshot.pages.push_back({ uint32_t(page), hidden });
+			snapshot.data.insert(snapshot.data.end(), current.data() + page, current.data() + page + page_size);
+			memcpy(previous.data() + page, current.data() + page, page_size);
+		}
+	};
+
+	uint32_t command;
+	while (scan_record(command, rdram, hidden_rdram))
 	{
-		iface->update_rdram(rdram_cache.data(), rdram_cache.size(), 0);
-		break;
+		if (static_cast<Command>(command) != Command::EndFrame)
+			continue;
+
+		frame_positions.push_back(get_position());
+		unsigned frame = unsigned(frame_positions.size() - 1);
+		if (snapshot_interval && (frame % snapshot_interval) == 0)
+		{
+			Snapshot snapshot = { frame };
+			diff_pages(snapshot, snapshot_rdram, rdram, false);
+			diff_pages(snapshot, snapshot_hidden_rdram, hidden_rdram, true);
+			snapshots.push_back(std::move(snapshot));
+		}
 	}
 
-	case Command::UpdateHiddenDramFlush:
+	return set_position(current_position);
+}
+
+unsigned DumpPlayer::get_indexed_frame_count() const
+{
+	return unsigned(frame_positions.size());
+}
+
+bool DumpPlayer::seek_to_frame(unsigned frame)
+{
+	if (frame >= frame_positions.size())
+		return false;
+
+	// Start from the closest snapshot, and only apply RDRAM updates from there.
+	auto itr = std::upper_bound(snapshots.begin(), snapshots.end(), frame, [](unsigned value, const Snapshot &snapshot) {
+		return value < snapshot.frame;
+	});
+
+	std::fill(rdram_cache.begin(), rdram_cache.end(), 0);
+	std::fill(rdram_hidden_cache.begin(), rdram_hidden_cache.end(), 0);
+	Position start = frame_positions.front();
+
+	// Snapshots are diffs against the previous one, so apply all of them in order.
+	for (auto snapshot = snapshots.begin(); snapshot != itr; ++snapshot)
 	{
-		iface->update_hidden_rdram(rdram_hidden_cache.data(), rdram_hidden_cache.size(), 0);
-		break;
+		const uint8_t *data = snapshot->data.data();
+		for (auto &page : snapshot->pages)
+		{
+			auto &cache = page.hidden ? rdram_hidden_cache : rdram_cache;
+			size_t page_size = std::min(SnapshotPageSize, cache.size() - page.offset);
+			memcpy(cache.data() + page.offset, data, page_size);
+			data += page_size;
+		}
+		start = frame_positions[snapshot->frame];
 	}
 
-	default:
+	if (!set_position(start))
 		return false;
+
+	auto &target = frame_positions[frame];
+	uint32_t command;
+	for (;;)
+	{
+		auto position = get_position();
+		if (position.block > target.block || (position.block == target.block && position.offset >= target.offset))
+			break;
+		if (!scan_record(command, rdram_cache, rdram_hidden_cache))
+			return false;
 	}
 
+	iface->update_rdram(rdram_cache.data(), rdram_cache.size(), 0);
+	iface->update_hidden_rdram(rdram_hidden_cache.data(), rdram_hidden_cache.size(), 0);
 	return true;
 }
 
+const uint8_t *DumpPlayer::read_data(size_t size)
+{
+	if (size > stream_size - read_offset)
+		return nullptr;
+
+	auto *data = stream + read_offset;
+	read_offset += size;
+	return data;
+}
+
 bool DumpPlayer::read_word(uint32_t &value)
 {
-	return fread(&value, sizeof(value), 1, file.get()) == 1;
+	auto *data = read_data(sizeof(value));
+	if (!data)
+		return false;
+	memcpy(&value, data, sizeof(value));
+	return true;
 }
 
 size_t DumpPlayer::get_rdram_size() const
@@ -198,4 +528,605 @@ size_t DumpPlayer::get_hidden_rdram_size() const
 {
 	return rdram_hidden_cache.size();
 }
+
+DumpWriter::~DumpWriter()
+{
+	close();
+}
+
+bool DumpWriter::open(const char *path, size_t rdram_size, size_t hidden_rdram_size, DumpFormat format_)
+{
+	close();
+	failed = false;
+	format = format_;
+
+	file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	const char *magic = format == DumpFormat::RDPDump3 ? "RDPDUMP3" : "RDPDUMP2";
+	uint32_t sizes[2] = { uint32_t(rdram_size), uint32_t(hidden_rdram_size) };
+	if (fwrite(magic, 1, 8, file) != 8 || fwrite(sizes, sizeof(uint32_t), 2, file) != 2)
+	{
+		close();
+		return false;
+	}
+
+	rdram.clear();
+	rdram.resize(rdram_size);
+	hidden_rdram.clear();
+	hidden_rdram.resize(hidden_rdram_size);
+	block.clear();
+	return true;
+}
+
+bool DumpWriter::close()
+{
+	if (!file)
+		return !failed;
+
+	flush_block();
+	if (fclose(file) != 0)
+		failed = true;
+	file = nullptr;
+	return !failed;
+}
+
+void DumpWriter::write_words(const uint32_t *words, size_t count)
+{
+	write_data(words, count * sizeof(uint32_t));
+}
+
+void DumpWriter::write_data(const void *data, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data);
+	block.insert(block.end(), bytes, bytes + size);
+}
+
+void DumpWriter::end_record()
+{
+	if (block.size() >= DumpBlockSize)
+		flush_block();
+}
+
+void DumpWriter::flush_block()
+{
+	if (!file || block.empty())
+		return;
+
+	if (format == DumpFormat::RDPDump2)
+	{
+		if (fwrite(block.data(), 1, block.size(), file) != block.size())
+			failed = true;
+		block.clear();
+		return;
+	}
+
+	compress_dump_block(block.data(), block.size(), compressed);
+
+	const uint8_t *payload = compressed.data();
+	uint32_t header[2] = { uint32_t(compressed.size()), uint32_t(block.size()) };
+	if (compressed.size() >= block.size())
+	{
+		payload = block.data();
+		header[0] = header[1];
+	}
+
+	if (fwrite(header, sizeof(uint32_t), 2, file) != 2 || fwrite(payload, 1, header[0], file) != header[0])
+		failed = true;
+	block.clear();
+}
+
+void DumpWriter::set_vi_register(VIRegister reg, uint32_t value)
+{
+	const uint32_t words[] = { uint32_t(Command::SetVIRegister), uint32_t(reg), value };
+	write_words(words, 3);
+	end_record();
+}
+
+void DumpWriter::signal_complete()
+{
+	const uint32_t words[] = { uint32_t(Command::SignalComplete) };
+	write_words(words, 1);
+	end_record();
+}
+
+void DumpWriter::command(Op cmd_id, uint32_t num_words, const uint32_t *words)
+{
+	const uint32_t header[] = { uint32_t(Command::RDPCommand), uint32_t(cmd_id), num_words };
+	write_words(header, 3);
+	write_words(words, num_words);
+	end_record();
+}
+
+void DumpWriter::end_frame()
+{
+	const uint32_t words[] = { uint32_t(Command::EndFrame) };
+	write_words(words, 1);
+	end_record();
+}
+
+void DumpWriter::eof()
+{
+	const uint32_t words[] = { uint32_t(Command::EndOfFile) };
+	write_words(words, 1);
+	close();
+}
+
+void DumpWriter::write_rdram_update(std::vector<uint8_t> &state, bool hidden,
+                                    const void *data_, size_t size, size_t offset)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+	if (offset + size > state.size())
+	{
+		failed = true;
+		return;
+	}
+
+	Command command, flush_command;
+	if (format == DumpFormat::RDPDump3)
+		command = hidden ? Command::UpdateHiddenDramDelta : Command::UpdateDramDelta;
+	else
+		command = hidden ? Command::UpdateHiddenDram : Command::UpdateDram;
+	flush_command = hidden ? Command::UpdateHiddenDramFlush : Command::UpdateDramFlush;
+
+	// Only emit updates for the pages which actually changed.
+	constexpr size_t PageSize = 4096;
+	constexpr size_t MaxUpdateSize = 64 * 1024;
+	std::vector<uint8_t> delta;
+
+	size_t page = 0;
+	while (page < size)
+	{
+		size_t page_size = std::min(PageSize, size - page);
+		if (memcmp(state.data() + offset + page, data + page, page_size) == 0)
+		{
+			page += page_size;
+			continue;
+		}
+
+		size_t begin = page;
+		while (page < size && page - begin < MaxUpdateSize)
+		{
+			page_size = std::min(PageSize, size - page);
+			if (memcmp(state.data() + offset + page, data + page, page_size) == 0)
+				break;
+			page += page_size;
+		}
+
+		size_t update_size = page - begin;
+		const uint32_t header[] = { uint32_t(command), uint32_t(offset + begin), uint32_t(update_size) };
+		write_words(header, 3);
+
+		if (format == DumpFormat::RDPDump3)
+		{
+			delta.resize(update_size);
+			for (size_t i = 0; i < update_size; i++)
+				delta[i] = state[offset + begin + i] ^ data[begin + i];
+			write_data(delta.data(), update_size);
+		}
+		else
+			write_data(data + begin, update_size);
+
+		memcpy(state.data() + offset + begin, data + begin, update_size);
+		end_record();
+	}
+
+	const uint32_t words[] = { uint32_t(flush_command) };
+	write_words(words, 1);
+	end_record();
+}
+
+void DumpWriter::update_rdram(const void *data, size_t size, size_t offset)
+{
+	write_rdram_update(rdram, false, data, size, offset);
+}
+
+void DumpWriter::update_hidden_rdram(const void *data, size_t size, size_t offset)
+{
+	write_rdram_update(hidden_rdram, true, data, size, offset);
+}
+
+DumpRecorder::~DumpRecorder()
+{
+	close();
+}
+
+bool DumpRecorder::open(const char *path, size_t rdram_size, size_t hidden_rdram_size, DumpFormat format)
+{
+	close();
+	failed = false;
+	dead = false;
+	back_pending = false;
+	front.clear();
+	back.clear();
+
+	if (!writer.open(path, rdram_size, hidden_rdram_size, format))
+		return false;
+
+	thread = std::thread(&DumpRecorder::thread_loop, this);
+	return true;
+}
+
+bool DumpRecorder::close()
+{
+	if (!thread.joinable())
+		return !failed;
+
+	if (!front.empty())
+		submit();
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		dead = true;
+	}
+	cond.notify_all();
+	thread.join();
+
+	if (!writer.close())
+		failed = true;
+	return !failed;
+}
+
+void DumpRecorder::write_words(const uint32_t *words, size_t count)
+{
+	write_data(words, count * sizeof(uint32_t));
+}
+
+void DumpRecorder::write_data(const void *data, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data);
+	front.insert(front.end(), bytes, bytes + size);
+}
+
+void DumpRecorder::submit()
+{
+	if (!thread.joinable())
+	{
+		front.clear();
+		return;
+	}
+
+	std::unique_lock<std::mutex> holder{lock};
+	// Only blocks if the writer thread is still busy with the previous buffer.
+	cond.wait(holder, [this]() {
+		return !back_pending;
+	});
+
+	std::swap(front, back);
+	back_pending = true;
+	holder.unlock();
+	cond.notify_all();
+}
+
+void DumpRecorder::thread_loop()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	for (;;)
+	{
+		cond.wait(holder, [this]() {
+			return back_pending || dead;
+		});
+
+		if (!back_pending)
+			break;
+
+		holder.unlock();
+		bool success = write_records(back);
+		back.clear();
+		holder.lock();
+
+		if (!success)
+			failed = true;
+		back_pending = false;
+		cond.notify_all();
+	}
+}
+
+bool DumpRecorder::write_records(const std::vector<uint8_t> &records)
+{
+	// Decode the records again and feed them through the writer.
+	size_t offset = 0;
+	auto read_word = [&](uint32_t &value) -> bool {
+		if (records.size() - offset < sizeof(value))
+			return false;
+		memcpy(&value, records.data() + offset, sizeof(value));
+		offset += sizeof(value);
+		return true;
+	};
+
+	while (offset < records.size())
+	{
+		uint32_t command_u32;
+		if (!read_word(command_u32))
+			return false;
+
+		switch (static_cast<Command>(command_u32))
+		{
+		case Command::SetVIRegister:
+		{
+			uint32_t index, value;
+			if (!read_word(index) || !read_word(value))
+				return false;
+			writer.set_vi_register(VIRegister(index), value);
+			break;
+		}
+
+		case Command::RDPCommand:
+		{
+			uint32_t cmd_id, word_count;
+			if (!read_word(cmd_id) || !read_word(word_count))
+				return false;
+			if ((records.size() - offset) / sizeof(uint32_t) < word_count)
+				return false;
+			command_buffer.resize(word_count);
+			if (word_count)
+				memcpy(command_buffer.data(), records.data() + offset, word_count * sizeof(uint32_t));
+			offset += word_count * sizeof(uint32_t);
+			writer.command(Op(cmd_id), word_count, command_buffer.data());
+			break;
+		}
+
+		case Command::EndFrame:
+			writer.end_frame();
+			break;
+
+		case Command::SignalComplete:
+			writer.signal_complete();
+			break;
+
+		case Command::EndOfFile:
+			writer.eof();
+			break;
+
+		case Command::UpdateDram:
+		case Command::UpdateHiddenDram:
+		{
+			uint32_t dram_offset, size;
+			if (!read_word(dram_offset) || !read_word(size))
+				return false;
+			if (records.size() - offset < size)
+				return false;
+
+			// DumpWriter emits the flush record itself.
+			if (static_cast<Command>(command_u32) == Command::UpdateDram)
+				writer.update_rdram(records.data() + offset, size, dram_offset);
+			else
+				writer.update_hidden_rdram(records.data() + offset, size, dram_offset);
+			offset += size;
+			break;
+		}
+
+		case Command::UpdateDramFlush:
+		case Command::UpdateHiddenDramFlush:
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void DumpRecorder::set_vi_register(VIRegister reg, uint32_t value)
+{
+	const uint32_t words[] = { uint32_t(Command::SetVIRegister), uint32_t(reg), value };
+	write_words(words, 3);
+}
+
+void DumpRecorder::signal_complete()
+{
+	const uint32_t words[] = { uint32_t(Command::SignalComplete) };
+	write_words(words, 1);
+}
+
+void DumpRecorder::command(Op cmd_id, uint32_t num_words, const uint32_t *words)
+{
+	const uint32_t header[] = { uint32_t(Command::RDPCommand), uint32_t(cmd_id), num_words };
+	write_words(header, 3);
+	write_words(words, num_words);
+	if (front.size() >= DumpBlockSize * 4)
+		submit();
+}
+
+void DumpRecorder::end_frame()
+{
+	const uint32_t words[] = { uint32_t(Command::EndFrame) };
+	write_words(words, 1);
+	submit();
+}
+
+void DumpRecorder::eof()
+{
+	const uint32_t words[] = { uint32_t(Command::EndOfFile) };
+	write_words(words, 1);
+	close();
+}
+
+void DumpRecorder::update_rdram(const void *data, size_t size, size_t offset)
+{
+	const uint32_t header[] = { uint32_t(Command::UpdateDram), uint32_t(offset), uint32_t(size) };
+	write_words(header, 3);
+	write_data(data, size);
+	const uint32_t flush[] = { uint32_t(Command::UpdateDramFlush) };
+	write_words(flush, 1);
+	if (front.size() >= DumpBlockSize * 4)
+		submit();
+}
+
+void DumpRecorder::update_hidden_rdram(const void *data, size_t size, size_t offset)
+{
+	const uint32_t header[] = { uint32_t(Command::UpdateHiddenDram), uint32_t(offset), uint32_t(size) };
+	write_words(header, 3);
+	write_data(data, size);
+	const uint32_t flush[] = { uint32_t(Command::UpdateHiddenDramFlush) };
+	write_words(flush, 1);
+	if (front.size() >= DumpBlockSize * 4)
+		submit();
+}
+
+bool PreloadedDump::load(DumpPlayer &player)
+{
+	calls.clear();
+	words.clear();
+	patches.clear();
+	patch_data.clear();
+	rdram.clear();
+	rdram.resize(player.get_rdram_size());
+	hidden_rdram.clear();
+	hidden_rdram.resize(player.get_hidden_rdram_size());
+
+	if (!player.rewind())
+		return false;
+
+	player.set_command_interface(this);
+	while (player.iterate())
+	{
+	}
+	player.set_command_interface(nullptr);
+
+	return rewind();
+}
+
+size_t PreloadedDump::get_rdram_size() const
+{
+	return rdram.size();
+}
+
+size_t PreloadedDump::get_hidden_rdram_size() const
+{
+	return hidden_rdram.size();
+}
+
+void PreloadedDump::set_command_interface(CommandListenerInterface *iface_)
+{
+	iface = iface_;
+}
+
+bool PreloadedDump::rewind()
+{
+	call_index = 0;
+	std::fill(rdram.begin(), rdram.end(), 0);
+	std::fill(hidden_rdram.begin(), hidden_rdram.end(), 0);
+	return true;
+}
+
+bool PreloadedDump::iterate()
+{
+	if (call_index >= calls.size())
+		return false;
+
+	auto &call = calls[call_index++];
+	switch (call.type)
+	{
+	case CallType::SetVIRegister:
+		iface->set_vi_register(VIRegister(call.offset), call.arg);
+		break;
+
+	case CallType::SignalComplete:
+		iface->signal_complete();
+		break;
+
+	case CallType::Command:
+		iface->command(Op(call.arg), call.size, words.data() + call.payload);
+		break;
+
+	case CallType::EndFrame:
+		iface->end_frame();
+		break;
+
+	case CallType::EndOfFile:
+		iface->eof();
+		return false;
+
+	case CallType::UpdateRDRAM:
+	case CallType::UpdateHiddenRDRAM:
+	{
+		auto &state = call.type == CallType::UpdateRDRAM ? rdram : hidden_rdram;
+		for (uint32_t i = 0; i < call.patch_count; i++)
+		{
+			auto &patch = patches[call.payload + i];
+			memcpy(state.data() + patch.offset, patch_data.data() + patch.data_offset, patch.size);
+		}
+
+		if (call.type == CallType::UpdateRDRAM)
+			iface->update_rdram(state.data() + call.offset, call.size, call.offset);
+		else
+			iface->update_hidden_rdram(state.data() + call.offset, call.size, call.offset);
+		break;
+	}
+	}
+
+	return true;
+}
+
+void PreloadedDump::set_vi_register(VIRegister reg, uint32_t value)
+{
+	calls.push_back({ CallType::SetVIRegister, value, uint32_t(reg), 0, 0, 0 });
+}
+
+void PreloadedDump::signal_complete()
+{
+	calls.push_back({ CallType::SignalComplete, 0, 0, 0, 0, 0 });
+}
+
+void PreloadedDump::command(Op cmd_id, uint32_t num_words, const uint32_t *words_)
+{
+	calls.push_back({ CallType::Command, uint32_t(cmd_id), 0, num_words, uint32_t(words.size()), 0 });
+	words.insert(words.end(), words_, words_ + num_words);
+}
+
+void PreloadedDump::end_frame()
+{
+	calls.push_back({ CallType::EndFrame, 0, 0, 0, 0, 0 });
+}
+
+void PreloadedDump::eof()
+{
+	calls.push_back({ CallType::EndOfFile, 0, 0, 0, 0, 0 });
+}
+
+void PreloadedDump::record_rdram_update(std::vector<uint8_t> &state, CallType type,
+                                        const void *data_, size_t size, size_t offset)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+	if (offset + size > state.size())
+		return;
+
+	Call call = { type, 0, uint32_t(offset), uint32_t(size), uint32_t(patches.size()), 0 };
+
+	// Only keep the pages which actually changed.
+	constexpr size_t PageSize = 4096;
+	for (size_t page = 0; page < size; page += PageSize)
+	{
+		size_t page_size = std::min(PageSize, size - page);
+		if (memcmp(state.data() + offset + page, data + page, page_size) == 0)
+			continue;
+
+		// Merge with the previous patch if contiguous.
+		if (call.patch_count && patches.back().offset + patches.back().size == offset + page)
+			patches.back().size += uint32_t(page_size);
+		else
+		{
+			patches.push_back({ uint32_t(offset + page), uint32_t(page_size), patch_data.size() });
+			call.patch_count++;
+		}
+
+		patch_data.insert(patch_data.end(), data + page, data + page + page_size);
+		memcpy(state.data() + offset + page, data + page, page_size);
+	}
+
+	calls.push_back(call);
+}
+
+void PreloadedDump::update_rdram(const void *data, size_t size, size_t offset)
+{
+	record_rdram_update(rdram, CallType::UpdateRDRAM, data, size, offset);
+}
+
+void PreloadedDump::update_hidden_rdram(const void *data, size_t size, size_t offset)
+{
+	record_rdram_update(hidden_rdram, CallType::UpdateHiddenRDRAM, data, size, offset);
+}
 }
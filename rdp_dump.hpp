@@ -26,8 +26,17 @@
 #include <stdint.h>
 #include <vector>
 #include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "rdp_common.hpp"
 
+namespace Granite
+{
+class File;
+}
+
 namespace RDP
 {
 
@@ -50,9 +59,15 @@ struct CommandInterface
 	virtual size_t get_hidden_rdram_size() const = 0;
 };
 
+// Reads RDPDUMP2 and RDPDUMP3 dumps.
+// The dump is memory mapped, and RDPDUMP2 commands are dispatched with pointers directly into the mapping.
+// RDPDUMP3 dumps are made of independently compressed blocks, where the next block is decompressed
+// on a worker thread while the current one is replayed.
 class DumpPlayer : public CommandInterface
 {
 public:
+	DumpPlayer();
+	~DumpPlayer();
 	bool load_dump(const char *path);
 	size_t get_rdram_size() const override;
 	size_t get_hidden_rdram_size() const override;
@@ -60,17 +75,221 @@ public:
 	bool rewind();
 	void set_command_interface(CommandListenerInterface *iface) override;
 
+	// Scans the dump once, recording where every frame begins.
+	// Every snapshot_interval frames, the RDRAM contents of the dump are snapshotted as well, so seeking
+	// only has to scan at most snapshot_interval frames. A snapshot only keeps the 4 KiB pages which changed
+	// since the previous one, but memory still grows with dump length: a dump which redraws its framebuffer
+	// every frame costs at least one framebuffer's worth of pages per snapshot.
+	// Lower intervals seek faster, higher intervals use less memory, 0 disables snapshots.
+	bool build_index(unsigned snapshot_interval = 256);
+	unsigned get_indexed_frame_count() const;
+
+	// Requires build_index(). Positions the dump right after EndFrame record number frame,
+	// and uploads the RDRAM contents of the dump at that point. Frame 0 is the start of the dump.
+	// RDP state and TMEM are not restored, the command stream is expected to re-establish them.
+	bool seek_to_frame(unsigned frame);
+
 private:
 	CommandListenerInterface *iface = nullptr;
 
-	struct FileDeleter
+	std::unique_ptr<Granite::File> file;
+	const uint8_t *mapped = nullptr;
+	size_t mapped_size = 0;
+
+	// Records are read from stream, which is either the mapping itself, or the current decompressed block.
+	const uint8_t *stream = nullptr;
+	size_t stream_size = 0;
+	size_t read_offset = 0;
+
+	struct Block
 	{
-		void operator()(FILE *f) { fclose(f); }
+		size_t offset;
+		uint32_t compressed_size;
+		uint32_t size;
 	};
-	std::unique_ptr<FILE, FileDeleter> file;
+	std::vector<Block> blocks;
+	size_t current_block = 0;
+	std::vector<uint8_t> block_data;
+	std::future<std::vector<uint8_t>> prefetched_block_data;
+	size_t prefetched_block = SIZE_MAX;
+	std::vector<uint8_t> decompress_block(size_t index) const;
+	bool load_block(size_t index);
+
+	struct Position
+	{
+		size_t block;
+		size_t offset;
+	};
+	Position get_start_position() const;
+	Position get_position() const;
+	bool set_position(const Position &position);
+	bool begin_record();
+
 	std::vector<uint8_t> rdram_cache;
 	std::vector<uint8_t> rdram_hidden_cache;
 	std::vector<uint32_t> command_buffer;
 	bool read_word(uint32_t &value);
+	const uint8_t *read_data(size_t size);
+
+	// Pages of RDRAM or hidden RDRAM which changed since the previous snapshot.
+	// Seeking applies every snapshot up to the target frame in order.
+	struct SnapshotPage
+	{
+		uint32_t offset;
+		bool hidden;
+	};
+	struct Snapshot
+	{
+		unsigned frame;
+		std::vector<SnapshotPage> pages;
+		std::vector<uint8_t> data;
+	};
+	std::vector<Position> frame_positions;
+	std::vector<Snapshot> snapshots;
+	bool scan_record(uint32_t &command, std::vector<uint8_t> &rdram, std::vector<uint8_t> &hidden_rdram);
+};
+
+enum class DumpFormat
+{
+	RDPDump2,
+	RDPDump3
+};
+
+// Writes dumps. RDRAM updates only store the pages which changed since the previous update.
+// For RDPDUMP3, records are gathered into blocks which are compressed independently,
+// and RDRAM updates are stored as XOR deltas against the previous RDRAM contents of the dump.
+class DumpWriter : public CommandListenerInterface
+{
+public:
+	~DumpWriter() override;
+	bool open(const char *path, size_t rdram_size, size_t hidden_rdram_size, DumpFormat format = DumpFormat::RDPDump3);
+	// Flushes pending records. Called implicitly by eof() and the destructor.
+	bool close();
+
+	void set_vi_register(VIRegister reg, uint32_t value) override;
+	void signal_complete() override;
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+	void end_frame() override;
+	void eof() override;
+	void update_rdram(const void *data, size_t size, size_t offset) override;
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override;
+
+private:
+	FILE *file = nullptr;
+	DumpFormat format = DumpFormat::RDPDump3;
+	bool failed = false;
+	std::vector<uint8_t> block;
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> rdram;
+	std::vector<uint8_t> hidden_rdram;
+
+	void write_words(const uint32_t *words, size_t count);
+	void write_data(const void *data, size_t size);
+	void end_record();
+	void flush_block();
+	void write_rdram_update(std::vector<uint8_t> &state, bool hidden, const void *data, size_t size, size_t offset);
+};
+
+// Records a command stream to a dump without stalling the caller on disk I/O.
+// Calls are serialized into a front buffer, which is handed over to a writer thread
+// at the end of every frame, or once it grows large. The writer thread feeds them through a DumpWriter.
+class DumpRecorder : public CommandListenerInterface
+{
+public:
+	~DumpRecorder() override;
+	bool open(const char *path, size_t rdram_size, size_t hidden_rdram_size, DumpFormat format = DumpFormat::RDPDump3);
+	// Waits for all records to be written. Called implicitly by eof() and the destructor.
+	bool close();
+
+	void set_vi_register(VIRegister reg, uint32_t value) override;
+	void signal_complete() override;
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+	void end_frame() override;
+	void eof() override;
+	void update_rdram(const void *data, size_t size, size_t offset) override;
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override;
+
+private:
+	DumpWriter writer;
+
+	std::vector<uint8_t> front;
+	std::vector<uint8_t> back;
+	std::vector<uint32_t> command_buffer;
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable cond;
+	bool back_pending = false;
+	bool dead = false;
+	bool failed = false;
+
+	void write_words(const uint32_t *words, size_t count);
+	void write_data(const void *data, size_t size);
+	void submit();
+	void thread_loop();
+	bool write_records(const std::vector<uint8_t> &records);
+};
+
+// Decodes an entire dump into memory once, so it can be replayed repeatedly without I/O or parsing,
+// e.g. for benchmarking. RDRAM updates only keep the pages which changed.
+class PreloadedDump : public CommandInterface, private CommandListenerInterface
+{
+public:
+	bool load(DumpPlayer &player);
+	size_t get_rdram_size() const override;
+	size_t get_hidden_rdram_size() const override;
+	bool iterate();
+	bool rewind();
+	void set_command_interface(CommandListenerInterface *iface) override;
+
+private:
+	CommandListenerInterface *iface = nullptr;
+
+	enum class CallType : uint32_t
+	{
+		SetVIRegister,
+		SignalComplete,
+		Command,
+		EndFrame,
+		EndOfFile,
+		UpdateRDRAM,
+		UpdateHiddenRDRAM
+	};
+
+	// For commands, payload is an offset into words.
+	// For RDRAM updates, payload is an index into patches, and patch_count patches follow.
+	struct Call
+	{
+		CallType type;
+		uint32_t arg;
+		uint32_t offset;
+		uint32_t size;
+		uint32_t payload;
+		uint32_t patch_count;
+	};
+
+	struct Patch
+	{
+		uint32_t offset;
+		uint32_t size;
+		size_t data_offset;
+	};
+
+	std::vector<Call> calls;
+	std::vector<uint32_t> words;
+	std::vector<Patch> patches;
+	std::vector<uint8_t> patch_data;
+	size_t call_index = 0;
+
+	std::vector<uint8_t> rdram;
+	std::vector<uint8_t> hidden_rdram;
+
+	void set_vi_register(VIRegister reg, uint32_t value) override;
+	void signal_complete() override;
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+	void end_frame() override;
+	void eof() override;
+	void update_rdram(const void *data, size_t size, size_t offset) override;
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override;
+	void record_rdram_update(std::vector<uint8_t> &state, CallType type, const void *data, size_t size, size_t offset);
 };
-}
\ No newline at end of file
+}
@@ -0,0 +1,180 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump_compression.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace RDP
+{
+// Every sequence is a token byte with literal length in the upper and match length in the lower nibble,
+// extended with 255-terminated length bytes, followed by literals and a 16-bit match offset.
+// The last sequence only has literals.
+enum
+{
+	MinMatch = 4,
+	MaxOffset = 0xffff,
+	HashBits = 14
+};
+
+static inline uint32_t load32(const uint8_t *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline uint32_t hash32(uint32_t value)
+{
+	return (value * 2654435761u) >> (32 - HashBits);
+}
+
+static void write_length(std::vector<uint8_t> &compressed, size_t length)
+{
+	while (length >= 255)
+	{
+		compressed.push_back(255);
+		length -= 255;
+	}
+	compressed.push_back(uint8_t(length));
+}
+
+static void write_sequence(std::vector<uint8_t> &compressed, const uint8_t *literals, size_t literal_count,
+                           size_t offset, size_t match_length)
+{
+	size_t match_code = match_length ? match_length - MinMatch : 0;
+	compressed.push_back(uint8_t((std::min<size_t>(literal_count, 15) << 4) | std::min<size_t>(match_code, 15)));
+	if (literal_count >= 15)
+		write_length(compressed, literal_count - 15);
+	compressed.insert(compressed.end(), literals, literals + literal_count);
+
+	if (match_length)
+	{
+		compressed.push_back(uint8_t(offset & 0xff));
+		compressed.push_back(uint8_t(offset >> 8));
+		if (match_code >= 15)
+			write_length(compressed, match_code - 15);
+	}
+}
+
+void compress_dump_block(const uint8_t *data, size_t size, std::vector<uint8_t> &compressed)
+{
+	compressed.clear();
+	compressed.reserve(size / 4);
+
+	std::vector<uint32_t> table(1u << HashBits, UINT32_MAX);
+	size_t anchor = 0;
+	size_t pos = 0;
+	unsigned misses = 0;
+
+	while (pos + MinMatch <= size)
+	{
+		uint32_t value = load32(data + pos);
+		uint32_t hash = hash32(value);
+		uint32_t candidate = table[hash];
+		table[hash] = uint32_t(pos);
+
+		if (candidate != UINT32_MAX && pos - candidate <= MaxOffset && load32(data + candidate) == value)
+		{
+			size_t length = MinMatch;
+			while (pos + length < size && data[candidate + length] == data[pos + length])
+				length++;
+
+			write_sequence(compressed, data + anchor, pos - anchor, pos - candidate, length);
+			pos += length;
+			anchor = pos;
+			misses = 0;
+		}
+		else
+		{
+			// Skip faster through incompressible data.
+			pos += 1 + (misses++ >> 6);
+		}
+	}
+
+	write_sequence(compressed, data + anchor, size - anchor, 0, 0);
+}
+
+static bool read_length(const uint8_t *&compressed, const uint8_t *end, size_t &length)
+{
+	uint8_t value;
+	do
+	{
+		if (compressed >= end)
+			return false;
+		value = *compressed++;
+		length += value;
+	} while (value == 255);
+	return true;
+}
+
+bool decompress_dump_block(const uint8_t *compressed, size_t compressed_size, uint8_t *data, size_t size)
+{
+	const uint8_t *end = compressed + compressed_size;
+	size_t pos = 0;
+
+	while (compressed < end)
+	{
+		uint8_t token = *compressed++;
+
+		size_t literal_count = token >> 4;
+		if (literal_count == 15 && !read_length(compressed, end, literal_count))
+			return false;
+		if (literal_count > size_t(end - compressed) || literal_count > size - pos)
+			return false;
+
+		memcpy(data + pos, compressed, literal_count);
+		compressed += literal_count;
+		pos += literal_count;
+
+		if (compressed == end)
+			break;
+
+		if (end - compressed < 2)
+			return false;
+		size_t offset = compressed[0] | (compressed[1] << 8);
+		compressed += 2;
+
+		size_t length = token & 15;
+		if (length == 15 && !read_length(compressed, end, length))
+			return false;
+		length += MinMatch;
+
+		if (offset == 0 || offset > pos || length > size - pos)
+			return false;
+
+		// Matches may overlap their own output, e.g. runs of zeroes with an offset of 1.
+		// The output repeats with a period of offset, so copy in chunks which grow with what has been written.
+		const uint8_t *src = data + pos - offset;
+		size_t copied = 0;
+		while (copied < length)
+		{
+			size_t chunk = std::min(offset + copied, length - copied);
+			memcpy(data + pos + copied, src, chunk);
+			copied += chunk;
+		}
+		pos += length;
+	}
+
+	return pos == size;
+}
+}
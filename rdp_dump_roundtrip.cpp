@@ -0,0 +1,553 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump.hpp"
+#include "rdp_dump_compression.hpp"
+#include "cli_parser.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+#include <random>
+#include <string.h>
+
+using namespace RDP;
+
+static void print_help()
+{
+	LOGE("Usage: rdp-dump-roundtrip\n"
+	     "\t[--output-dir <Directory for temporary dumps>]\n"
+	     "\t[--frames <count>]\n"
+	);
+}
+
+static bool test_codec_roundtrip(const char *name, const std::vector<uint8_t> &data)
+{
+	std::vector<uint8_t> compressed;
+	compress_dump_block(data.data(), data.size(), compressed);
+
+	std::vector<uint8_t> decompressed(data.size());
+	if (!decompress_dump_block(compressed.data(), compressed.size(), decompressed.data(), decompressed.size()) ||
+	    decompressed != data)
+	{
+		LOGE("Codec round-trip of %s (%zu bytes) failed.\n", name, data.size());
+		return false;
+	}
+
+	// Output sizes must match exactly.
+	decompressed.resize(data.size() + 1);
+	if (decompress_dump_block(compressed.data(), compressed.size(), decompressed.data(), decompressed.size()))
+	{
+		LOGE("Codec accepted wrong output size for %s.\n", name);
+		return false;
+	}
+
+	// Only a trailing empty sequence is redundant, so dropping half the stream must always be detected.
+	if (compressed.size() >= 4 &&
+	    decompress_dump_block(compressed.data(), compressed.size() / 2, decompressed.data(), data.size()))
+	{
+		LOGE("Codec accepted truncated stream for %s.\n", name);
+		return false;
+	}
+
+	LOGI("Codec round-trip of %s: %zu -> %zu bytes.\n", name, data.size(), compressed.size());
+	return true;
+}
+
+static bool test_codec(std::mt19937 &rnd)
+{
+	constexpr size_t BlockSize = 1024 * 1024;
+	bool success = true;
+
+	success &= test_codec_roundtrip("empty", {});
+	for (size_t size : { size_t(1), size_t(3), size_t(4), size_t(5), size_t(17), size_t(4096) })
+	{
+		std::vector<uint8_t> data(size);
+		for (auto &d : data)
+			d = uint8_t(rnd());
+		success &= test_codec_roundtrip("small random", data);
+	}
+
+	std::vector<uint8_t> data(BlockSize);
+	success &= test_codec_roundtrip("zeros", data);
+
+	for (auto &d : data)
+		d = uint8_t(rnd());
+	success &= test_codec_roundtrip("incompressible", data);
+
+	// Periods shorter than, equal to and longer than the minimum match, and longer than the maximum offset.
+	for (size_t period : { size_t(1), size_t(3), size_t(4), size_t(1000), size_t(0x10001) })
+	{
+		std::vector<uint8_t> pattern(period);
+		for (auto &p : pattern)
+			p = uint8_t(rnd());
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = pattern[i % period];
+		success &= test_codec_roundtrip("repeating", data);
+	}
+
+	// Low entropy data with long runs in between, which mixes literals, short and long matches.
+	for (size_t i = 0; i < data.size(); )
+	{
+		size_t run = rnd() % 600;
+		uint8_t value = (rnd() & 1) ? 0 : uint8_t(rnd());
+		for (size_t j = 0; j < run && i < data.size(); j++, i++)
+			data[i] = (rnd() & 7) ? value : uint8_t(rnd() & 3);
+	}
+	success &= test_codec_roundtrip("mixed", data);
+
+	return success;
+}
+
+// A synthetic command stream which exercises every record type. RDRAM is either updated in full,
+// which is what emulators do, or partially with unaligned offsets and sizes.
+struct Event
+{
+	enum class Type
+	{
+		SetVIRegister,
+		SignalComplete,
+		Command,
+		EndFrame,
+		UpdateRDRAM,
+		UpdateHiddenRDRAM
+	};
+	Type type;
+	uint32_t arg;
+	bool full;
+	size_t offset;
+	std::vector<uint32_t> words;
+	std::vector<uint8_t> data;
+};
+
+struct Script
+{
+	size_t rdram_size;
+	size_t hidden_rdram_size;
+	std::vector<Event> events;
+};
+
+static void generate_rdram_update(std::mt19937 &rnd, Script &script, Event::Type type, size_t size, bool incompressible)
+{
+	Event event = {};
+	event.type = type;
+	event.full = (rnd() & 1) != 0;
+
+	if (incompressible)
+	{
+		event.offset = 0;
+		event.data.resize(size / 2);
+	}
+	else
+	{
+		// Unaligned, odd sized, and sometimes crossing page boundaries.
+		size_t update_size = 1 + rnd() % ((rnd() & 3) ? 64 : 3 * 4096);
+		event.offset = rnd() % (size - update_size + 1);
+		event.data.resize(update_size);
+	}
+
+	bool zeros = !incompressible && (rnd() & 3) == 0;
+	for (auto &d : event.data)
+		d = zeros ? 0 : uint8_t(rnd());
+
+	script.events.push_back(std::move(event));
+}
+
+static Script generate_script(std::mt19937 &rnd, unsigned frames)
+{
+	Script script;
+	script.rdram_size = 4 * 1024 * 1024;
+	script.hidden_rdram_size = 4 * 1024 * 1024;
+
+	for (unsigned frame = 0; frame < frames; frame++)
+	{
+		unsigned vi_updates = rnd() % 4;
+		for (unsigned i = 0; i < vi_updates; i++)
+		{
+			Event event = {};
+			event.type = Event::Type::SetVIRegister;
+			event.arg = rnd() % unsigned(VIRegister::Count);
+			event.words.push_back(uint32_t(rnd()));
+			script.events.push_back(std::move(event));
+		}
+
+		unsigned commands = rnd() % 300;
+		for (unsigned i = 0; i < commands; i++)
+		{
+			if ((rnd() % 64) == 0)
+			{
+				if (rnd() & 1)
+					generate_rdram_update(rnd, script, Event::Type::UpdateHiddenRDRAM, script.hidden_rdram_size, false);
+				else
+					generate_rdram_update(rnd, script, Event::Type::UpdateRDRAM, script.rdram_size, false);
+			}
+
+			Event event = {};
+			event.type = Event::Type::Command;
+			event.arg = rnd() % 64;
+			event.words.resize(rnd() % 45);
+
+			// Command words repeat a lot in real dumps, so mix in some constant words.
+			for (auto &w : event.words)
+				w = (rnd() & 1) ? uint32_t(rnd()) : 0x3f000000u;
+			script.events.push_back(std::move(event));
+
+			if ((rnd() % 100) == 0)
+				script.events.push_back({ Event::Type::SignalComplete });
+		}
+
+		unsigned rdram_updates = rnd() % 4;
+		for (unsigned i = 0; i < rdram_updates; i++)
+			generate_rdram_update(rnd, script, Event::Type::UpdateRDRAM, script.rdram_size, false);
+		if ((frame % 7) == 3)
+			generate_rdram_update(rnd, script, Event::Type::UpdateRDRAM, script.rdram_size, true);
+		if (rnd() & 1)
+			generate_rdram_update(rnd, script, Event::Type::UpdateHiddenRDRAM, script.hidden_rdram_size, false);
+
+		script.events.push_back({ Event::Type::EndFrame });
+	}
+
+	return script;
+}
+
+static void apply_rdram_update(std::vector<uint8_t> &rdram, const Event &event)
+{
+	memcpy(rdram.data() + event.offset, event.data.data(), event.data.size());
+}
+
+static void play_script(const Script &script, CommandListenerInterface &iface)
+{
+	std::vector<uint8_t> rdram(script.rdram_size);
+	std::vector<uint8_t> hidden_rdram(script.hidden_rdram_size);
+
+	for (auto &event : script.events)
+	{
+		switch (event.type)
+		{
+		case Event::Type::SetVIRegister:
+			iface.set_vi_register(VIRegister(event.arg), event.words.front());
+			break;
+
+		case Event::Type::SignalComplete:
+			iface.signal_complete();
+			break;
+
+		case Event::Type::Command:
+			iface.command(Op(event.arg), uint32_t(event.words.size()), event.words.data());
+			break;
+
+		case Event::Type::EndFrame:
+			iface.end_frame();
+			break;
+
+		case Event::Type::UpdateRDRAM:
+		case Event::Type::UpdateHiddenRDRAM:
+		{
+			bool hidden = event.type == Event::Type::UpdateHiddenRDRAM;
+			auto &state = hidden ? hidden_rdram : rdram;
+			apply_rdram_update(state, event);
+
+			const uint8_t *data = event.full ? state.data() : event.data.data();
+			size_t size = event.full ? state.size() : event.data.size();
+			size_t offset = event.full ? 0 : event.offset;
+			if (hidden)
+				iface.update_hidden_rdram(data, size, offset);
+			else
+				iface.update_rdram(data, size, offset);
+			break;
+		}
+		}
+	}
+
+	iface.eof();
+}
+
+// Walks the script alongside a replayed dump. RDRAM updates may be split or merged by the writer,
+// so every other record is checked against the script, and RDRAM contents are checked
+// as soon as the next non-RDRAM record arrives.
+struct ScriptChecker : CommandListenerInterface
+{
+	explicit ScriptChecker(const Script &script_)
+		: script(script_),
+		  rdram(script.rdram_size), hidden_rdram(script.hidden_rdram_size),
+		  expected_rdram(script.rdram_size), expected_hidden_rdram(script.hidden_rdram_size)
+	{
+	}
+
+	const Script &script;
+	size_t event_index = 0;
+	bool failed = false;
+	bool seen_eof = false;
+	bool rdram_dirty = false;
+
+	std::vector<uint8_t> rdram, hidden_rdram;
+	std::vector<uint8_t> expected_rdram, expected_hidden_rdram;
+
+	bool sync_rdram(const char *tag)
+	{
+		if (failed)
+			return false;
+
+		while (event_index < script.events.size())
+		{
+			auto &event = script.events[event_index];
+			if (event.type == Event::Type::UpdateRDRAM)
+				apply_rdram_update(expected_rdram, event);
+			else if (event.type == Event::Type::UpdateHiddenRDRAM)
+				apply_rdram_update(expected_hidden_rdram, event);
+			else
+				break;
+			event_index++;
+			rdram_dirty = true;
+		}
+
+		if (rdram_dirty && (rdram != expected_rdram || hidden_rdram != expected_hidden_rdram))
+			return fail(tag, "RDRAM contents differ");
+		rdram_dirty = false;
+		return true;
+	}
+
+	bool next_event(Event::Type type, const char *tag)
+	{
+		if (!sync_rdram(tag))
+			return false;
+		if (event_index >= script.events.size())
+			return fail(tag, "unexpected record past the end of the script");
+		if (script.events[event_index].type != type)
+			return fail(tag, "unexpected record type");
+		return true;
+	}
+
+	bool fail(const char *tag, const char *reason)
+	{
+		LOGE("Mismatch at %s, event %zu: %s.\n", tag, event_index, reason);
+		failed = true;
+		return false;
+	}
+
+	void set_vi_register(VIRegister reg, uint32_t value) override
+	{
+		if (!next_event(Event::Type::SetVIRegister, "SetVIRegister"))
+			return;
+		auto &event = script.events[event_index++];
+		if (event.arg != uint32_t(reg) || event.words.front() != value)
+			fail("SetVIRegister", "register or value differs");
+	}
+
+	void signal_complete() override
+	{
+		if (next_event(Event::Type::SignalComplete, "SignalComplete"))
+			event_index++;
+	}
+
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override
+	{
+		if (!next_event(Event::Type::Command, "Command"))
+			return;
+		auto &event = script.events[event_index++];
+		if (event.arg != uint32_t(cmd_id) || event.words.size() != num_words ||
+		    (num_words && memcmp(event.words.data(), words, num_words * sizeof(uint32_t)) != 0))
+		{
+			fail("Command", "command words differ");
+		}
+	}
+
+	void end_frame() override
+	{
+		if (next_event(Event::Type::EndFrame, "EndFrame"))
+			event_index++;
+	}
+
+	void eof() override
+	{
+		if (sync_rdram("EndOfFile") && event_index != script.events.size())
+			fail("EndOfFile", "dump ended before the script");
+		seen_eof = true;
+	}
+
+	void update_rdram(const void *data, size_t size, size_t offset) override
+	{
+		if (offset + size > rdram.size())
+			fail("UpdateRDRAM", "update out of range");
+		else
+			memcpy(rdram.data() + offset, data, size);
+		rdram_dirty = true;
+	}
+
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override
+	{
+		if (offset + size > hidden_rdram.size())
+			fail("UpdateHiddenRDRAM", "update out of range");
+		else
+			memcpy(hidden_rdram.data() + offset, data, size);
+		rdram_dirty = true;
+	}
+};
+
+static bool verify_dump(const Script &script, const std::string &path)
+{
+	DumpPlayer player;
+	if (!player.load_dump(path.c_str()))
+	{
+		LOGE("Failed to load dump: %s\n", path.c_str());
+		return false;
+	}
+
+	if (player.get_rdram_size() != script.rdram_size || player.get_hidden_rdram_size() != script.hidden_rdram_size)
+	{
+		LOGE("RDRAM sizes of %s do not match.\n", path.c_str());
+		return false;
+	}
+
+	ScriptChecker checker(script);
+	player.set_command_interface(&checker);
+	while (player.iterate() && !checker.failed)
+	{
+	}
+
+	if (!checker.failed && !checker.seen_eof)
+		checker.fail("EndOfFile", "dump is truncated");
+
+	if (checker.failed)
+	{
+		LOGE("Round-trip of %s failed.\n", path.c_str());
+		return false;
+	}
+
+	LOGI("Round-trip of %s passed.\n", path.c_str());
+	return true;
+}
+
+static bool write_script(const Script &script, const std::string &path, DumpFormat format)
+{
+	DumpWriter writer;
+	if (!writer.open(path.c_str(), script.rdram_size, script.hidden_rdram_size, format))
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	play_script(script, writer);
+	if (!writer.close())
+	{
+		LOGE("Failed to write %s.\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Full RDRAM updates are larger than the threshold for handing over the front buffer,
+// so this also exercises submits in the middle of a frame.
+static bool record_script(const Script &script, const std::string &path, DumpFormat format)
+{
+	DumpRecorder recorder;
+	if (!recorder.open(path.c_str(), script.rdram_size, script.hidden_rdram_size, format))
+	{
+		LOGE("Failed to open %s for recording.\n", path.c_str());
+		return false;
+	}
+
+	play_script(script, recorder);
+	if (!recorder.close())
+	{
+		LOGE("Failed to record %s.\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Same as rdp-compress-dump.
+static bool convert_dump(const std::string &path, const std::string &output_path, DumpFormat format)
+{
+	DumpPlayer player;
+	DumpWriter writer;
+	if (!player.load_dump(path.c_str()) ||
+	    !writer.open(output_path.c_str(), player.get_rdram_size(), player.get_hidden_rdram_size(), format))
+	{
+		LOGE("Failed to convert %s to %s.\n", path.c_str(), output_path.c_str());
+		return false;
+	}
+
+	player.set_command_interface(&writer);
+	while (player.iterate())
+	{
+	}
+
+	if (!writer.close())
+	{
+		LOGE("Failed to write %s.\n", output_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	std::string output_dir = ".";
+	unsigned frames = 64;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output-dir", [&](Util::CLIParser &parser) { output_dir = parser.next_string(); });
+	cbs.add("--frames", [&](Util::CLIParser &parser) { frames = parser.next_uint(); });
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	std::mt19937 rnd(1337);
+	if (!test_codec(rnd))
+		return EXIT_FAILURE;
+
+	Script script = generate_script(rnd, frames);
+	std::string dump2_path = output_dir + "/rdp-dump-roundtrip-2.rdp";
+	std::string dump3_path = output_dir + "/rdp-dump-roundtrip-3.rdp";
+	std::string converted_path = output_dir + "/rdp-dump-roundtrip-converted.rdp";
+	std::string recorded2_path = output_dir + "/rdp-dump-roundtrip-recorded-2.rdp";
+	std::string recorded3_path = output_dir + "/rdp-dump-roundtrip-recorded-3.rdp";
+
+	bool success =
+			write_script(script, dump2_path, DumpFormat::RDPDump2) && verify_dump(script, dump2_path) &&
+			write_script(script, dump3_path, DumpFormat::RDPDump3) && verify_dump(script, dump3_path) &&
+			convert_dump(dump2_path, converted_path, DumpFormat::RDPDump3) && verify_dump(script, converted_path) &&
+			record_script(script, recorded2_path, DumpFormat::RDPDump2) && verify_dump(script, recorded2_path) &&
+			record_script(script, recorded3_path, DumpFormat::RDPDump3) && verify_dump(script, recorded3_path);
+
+	remove(dump2_path.c_str());
+	remove(dump3_path.c_str());
+	remove(converted_path.c_str());
+	remove(recorded2_path.c_str());
+	remove(recorded3_path.c_str());
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
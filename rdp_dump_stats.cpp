@@ -0,0 +1,648 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump.hpp"
+#include "rdp_device.hpp"
+#include "replayer_driver.hpp"
+#include "cli_parser.hpp"
+#include "global_managers.hpp"
+#include "hash.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace RDP;
+
+// Reasons for the renderer to flush its queues, as modelled from Renderer and ParallelReplayer.
+enum class FlushReason : unsigned
+{
+	SyncFull,
+	SignalComplete,
+	RDRAMUpdate,
+	Scanout,
+	ColorFramebuffer,
+	DepthFramebuffer,
+	TMEMCoherency,
+	TMEMInstances,
+	Primitives,
+	StaticStates,
+	DepthBlendStates,
+	SpanSetups,
+	Count
+};
+
+static const char *flush_reason_name(FlushReason reason)
+{
+	switch (reason)
+	{
+	case FlushReason::SyncFull: return "SyncFull";
+	case FlushReason::SignalComplete: return "signal_complete";
+	case FlushReason::RDRAMUpdate: return "RDRAM update";
+	case FlushReason::Scanout: return "scanout";
+	case FlushReason::ColorFramebuffer: return "color framebuffer change";
+	case FlushReason::DepthFramebuffer: return "depth framebuffer change";
+	case FlushReason::TMEMCoherency: return "TMEM upload from pending framebuffer";
+	case FlushReason::TMEMInstances: return "TMEM upload limit";
+	case FlushReason::Primitives: return "primitive limit";
+	case FlushReason::StaticStates: return "static state limit";
+	case FlushReason::DepthBlendStates: return "depth blend state limit";
+	case FlushReason::SpanSetups: return "span setup limit";
+	default: return "???";
+	}
+}
+
+static const char *fb_format_name(FBFormat fmt)
+{
+	switch (fmt)
+	{
+	case FBFormat::I4: return "I4";
+	case FBFormat::I8: return "I8";
+	case FBFormat::RGBA5551: return "RGBA5551";
+	case FBFormat::IA88: return "IA88";
+	case FBFormat::RGBA8888: return "RGBA8888";
+	default: return "???";
+	}
+}
+
+static const char *upload_mode_name(UploadMode mode)
+{
+	switch (mode)
+	{
+	case UploadMode::Tile: return "LoadTile";
+	case UploadMode::TLUT: return "LoadTLUT";
+	case UploadMode::Block: return "LoadBlock";
+	default: return "???";
+	}
+}
+
+template <typename T>
+struct StateEntry
+{
+	T state;
+	uint64_t primitives;
+};
+
+struct FramebufferEntry
+{
+	FBFormat fmt;
+	unsigned width;
+	uint64_t set_count;
+	uint64_t primitives;
+};
+
+// Decodes the command stream like CommandProcessor would, and gathers statistics without rendering anything.
+// Flushes are modelled after the batching limits in Renderer. Tile state and shaded tile limits are not modelled.
+class DumpStats : public CommandListenerInterface
+{
+public:
+	void set_vi_register(VIRegister, uint32_t) override
+	{
+	}
+
+	void signal_complete() override
+	{
+		flush(FlushReason::SignalComplete);
+	}
+
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+
+	void end_frame() override
+	{
+		flush(FlushReason::Scanout);
+		frames++;
+	}
+
+	void eof() override
+	{
+	}
+
+	void update_rdram(const void *, size_t size, size_t) override
+	{
+		flush(FlushReason::RDRAMUpdate);
+		rdram_updates++;
+		rdram_update_bytes += size;
+	}
+
+	void update_hidden_rdram(const void *, size_t size, size_t) override
+	{
+		flush(FlushReason::RDRAMUpdate);
+		rdram_updates++;
+		rdram_update_bytes += size;
+	}
+
+	void report() const;
+
+private:
+	uint64_t frames = 0;
+	uint64_t rdram_updates = 0;
+	uint64_t rdram_update_bytes = 0;
+
+	uint64_t command_counts[64] = {};
+	uint64_t command_words[64] = {};
+
+	uint64_t flush_counts[unsigned(FlushReason::Count)] = {};
+	uint64_t flush_primitives[unsigned(FlushReason::Count)] = {};
+	std::vector<unsigned> primitives_per_flush;
+
+	uint64_t upload_counts[3] = {};
+	uint64_t upload_bytes[3] = {};
+
+	std::unordered_map<Util::Hash, StateEntry<StaticRasterizationState>> static_states;
+	std::unordered_map<Util::Hash, StateEntry<DepthBlendState>> depth_blend_states;
+	std::unordered_map<Util::Hash, FramebufferEntry> framebuffers;
+	std::unordered_map<Util::Hash, uint64_t> combined_state_hashes;
+
+	// Decoded state, as tracked by CommandProcessor.
+	StaticRasterizationState static_state = {};
+	DepthBlendState depth_blend = {};
+	ScissorState scissor_state = {};
+
+	struct
+	{
+		uint32_t addr = 0;
+		uint32_t width = 0;
+		FBFormat fmt = FBFormat::I8;
+		uint32_t depth_addr = 0;
+		uint32_t deduced_height = 0;
+		bool color_write_pending = false;
+		bool depth_write_pending = false;
+	} fb;
+
+	struct
+	{
+		uint32_t addr = 0;
+		uint32_t width = 0;
+		TextureSize size = TextureSize::Bpp4;
+	} texture_image;
+
+	// Pending work in the current batch.
+	unsigned pending_primitives = 0;
+	unsigned pending_uploads = 0;
+	unsigned pending_span_lines = 0;
+	std::vector<Util::Hash> pending_static_states;
+	std::vector<Util::Hash> pending_depth_blend_states;
+
+	void flush(FlushReason reason);
+	void draw(const TriangleSetup &setup);
+	void load_tile(UploadMode mode, const uint32_t *words);
+	bool tmem_upload_needs_flush(uint32_t addr) const;
+	void set_color_image(const uint32_t *words);
+	void set_mask_image(const uint32_t *words);
+	static bool add_pending_state(std::vector<Util::Hash> &states, Util::Hash hash, unsigned limit);
+};
+
+void DumpStats::flush(FlushReason reason)
+{
+	// Flushing an empty batch is free, so it is not counted.
+	if (!pending_primitives && !pending_uploads)
+		return;
+
+	flush_counts[unsigned(reason)]++;
+	flush_primitives[unsigned(reason)] += pending_primitives;
+	primitives_per_flush.push_back(pending_primitives);
+
+	pending_primitives = 0;
+	pending_uploads = 0;
+	pending_span_lines = 0;
+	pending_static_states.clear();
+	pending_depth_blend_states.clear();
+	fb.deduced_height = 0;
+	fb.color_write_pending = false;
+	fb.depth_write_pending = false;
+}
+
+bool DumpStats::add_pending_state(std::vector<Util::Hash> &states, Util::Hash hash, unsigned limit)
+{
+	if (std::find(states.begin(), states.end(), hash) != states.end())
+		return true;
+	if (states.size() >= limit)
+		return false;
+	states.push_back(hash);
+	return true;
+}
+
+void DumpStats::draw(const TriangleSetup &setup)
+{
+	Util::Hasher static_hasher;
+	static_hasher.data(reinterpret_cast<const uint8_t *>(&static_state), sizeof(static_state));
+	Util::Hasher depth_blend_hasher;
+	depth_blend_hasher.data(reinterpret_cast<const uint8_t *>(&depth_blend), sizeof(depth_blend));
+	Util::Hash static_hash = static_hasher.get();
+	Util::Hash depth_blend_hash = depth_blend_hasher.get();
+
+	auto &static_entry = static_states[static_hash];
+	static_entry.state = static_state;
+	static_entry.primitives++;
+
+	auto &depth_blend_entry = depth_blend_states[depth_blend_hash];
+	depth_blend_entry.state = depth_blend;
+	depth_blend_entry.primitives++;
+
+	Util::Hasher combined_hasher;
+	combined_hasher.u64(static_hash);
+	combined_hasher.u64(depth_blend_hash);
+	combined_state_hashes[combined_hasher.get()]++;
+
+	Util::Hasher fb_hasher;
+	fb_hasher.u32(uint32_t(fb.fmt));
+	fb_hasher.u32(fb.width);
+	auto &fb_entry = framebuffers[fb_hasher.get()];
+	fb_entry.fmt = fb.fmt;
+	fb_entry.width = fb.width;
+	fb_entry.primitives++;
+
+	if (!add_pending_state(pending_static_states, static_hash, Limits::MaxStaticRasterizationStates))
+	{
+		flush(FlushReason::StaticStates);
+		pending_static_states.push_back(static_hash);
+	}
+
+	if (!add_pending_state(pending_depth_blend_states, depth_blend_hash, Limits::MaxDepthBlendStates))
+	{
+		flush(FlushReason::DepthBlendStates);
+		pending_depth_blend_states.push_back(depth_blend_hash);
+	}
+
+	// Same line accounting as Renderer::allocate_span_jobs() and Renderer::update_deduced_height().
+	int min_active_line = std::min(int(setup.yh), int(scissor_state.yhi)) >> 2;
+	int max_active_line = std::min(setup.yl - 1, int(scissor_state.yhi) - 1) >> 2;
+	int height = std::min(std::max(max_active_line - min_active_line + 2, 0), 1024);
+	pending_span_lines += height;
+	fb.deduced_height = std::max(fb.deduced_height, uint32_t(std::max(max_active_line + 1, 0)));
+
+	pending_primitives++;
+	fb.color_write_pending = true;
+	if (depth_blend.flags & DEPTH_BLEND_DEPTH_UPDATE_BIT)
+		fb.depth_write_pending = true;
+
+	if (pending_primitives >= Limits::MaxPrimitives)
+		flush(FlushReason::Primitives);
+	else if (pending_span_lines + Limits::MaxHeight > Limits::MaxSpanSetups)
+		flush(FlushReason::SpanSetups);
+}
+
+bool DumpStats::tmem_upload_needs_flush(uint32_t addr) const
+{
+	if (fb.color_write_pending)
+	{
+		uint32_t offset = addr - fb.addr;
+		if (fb.fmt == FBFormat::RGBA5551 || fb.fmt == FBFormat::I8)
+			offset >>= 1;
+		else if (fb.fmt == FBFormat::RGBA8888)
+			offset >>= 2;
+
+		if (offset < fb.deduced_height * fb.width)
+			return true;
+	}
+
+	if (fb.depth_write_pending)
+	{
+		uint32_t offset = (addr - fb.depth_addr) >> 1;
+		if (offset < fb.deduced_height * fb.width)
+			return true;
+	}
+
+	return false;
+}
+
+void DumpStats::load_tile(UploadMode mode, const uint32_t *words)
+{
+	if (tmem_upload_needs_flush(texture_image.addr))
+		flush(FlushReason::TMEMCoherency);
+
+	uint32_t slo = (words[0] >> 12) & 0xfff;
+	uint32_t shi = (words[1] >> 12) & 0xfff;
+	uint32_t tlo = (words[0] >> 0) & 0xfff;
+	uint32_t thi = (words[1] >> 0) & 0xfff;
+
+	// Bytes read from RDRAM, in units of half bytes to account for 4 bpp.
+	uint64_t texels;
+	unsigned half_bytes_per_texel = 1u << unsigned(texture_image.size);
+	switch (mode)
+	{
+	case UploadMode::Block:
+		// shi is the last texel, tlo and thi hold the line stride.
+		texels = shi >= slo ? shi - slo + 1 : 0;
+		break;
+
+	case UploadMode::TLUT:
+		// TLUT entries are always 16-bit.
+		texels = (shi >> 2) >= (slo >> 2) ? (shi >> 2) - (slo >> 2) + 1 : 0;
+		half_bytes_per_texel = 4;
+		break;
+
+	default:
+	{
+		uint64_t width = (shi >> 2) >= (slo >> 2) ? (shi >> 2) - (slo >> 2) + 1 : 0;
+		uint64_t height = (thi >> 2) >= (tlo >> 2) ? (thi >> 2) - (tlo >> 2) + 1 : 0;
+		texels = width * height;
+		break;
+	}
+	}
+
+	upload_counts[unsigned(mode)]++;
+	upload_bytes[unsigned(mode)] += (texels * half_bytes_per_texel + 1) / 2;
+
+	pending_uploads++;
+	if (pending_uploads + 1 >= Limits::MaxTMEMInstances)
+		flush(FlushReason::TMEMInstances);
+}
+
+void DumpStats::set_color_image(const uint32_t *words)
+{
+	uint32_t width = (words[0] & 1023) + 1;
+	uint32_t addr = words[1] & 0xffffff;
+
+	FBFormat fmt;
+	if (!decode_color_image_format(fmt, words))
+		return;
+
+	if (fb.addr != addr || fb.width != width || fb.fmt != fmt)
+		flush(FlushReason::ColorFramebuffer);
+
+	fb.addr = addr;
+	fb.width = width;
+	fb.fmt = fmt;
+
+	Util::Hasher h;
+	h.u32(uint32_t(fmt));
+	h.u32(width);
+	auto &entry = framebuffers[h.get()];
+	entry.fmt = fmt;
+	entry.width = width;
+	entry.set_count++;
+}
+
+void DumpStats::set_mask_image(const uint32_t *words)
+{
+	uint32_t addr = words[1] & 0xffffff;
+	if (fb.depth_addr != addr)
+		flush(FlushReason::DepthFramebuffer);
+	fb.depth_addr = addr;
+}
+
+void DumpStats::command(Op cmd_id, uint32_t num_words, const uint32_t *words)
+{
+	command_counts[unsigned(cmd_id) & 63]++;
+	command_words[unsigned(cmd_id) & 63] += num_words;
+
+	bool copy_cycle = (static_state.flags & RASTERIZATION_COPY_BIT) != 0;
+
+	switch (cmd_id)
+	{
+	case Op::FillTriangle:
+	case Op::FillZBufferTriangle:
+	case Op::TextureTriangle:
+	case Op::TextureZBufferTriangle:
+	case Op::ShadeTriangle:
+	case Op::ShadeZBufferTriangle:
+	case Op::ShadeTextureTriangle:
+	case Op::ShadeTextureZBufferTriangle:
+	{
+		TriangleSetup setup = {};
+		decode_triangle_setup(setup, words, copy_cycle);
+		draw(setup);
+		break;
+	}
+
+	case Op::FillRectangle:
+	case Op::TextureRectangle:
+	case Op::TextureRectangleFlip:
+	{
+		TriangleSetup setup = {};
+		setup.yl = int32_t((words[0] >> 0) & 0xfff);
+		setup.yh = int32_t((words[1] >> 0) & 0xfff);
+		if ((static_state.flags & (RASTERIZATION_COPY_BIT | RASTERIZATION_FILL_BIT)) != 0)
+			setup.yl |= 3;
+		draw(setup);
+		break;
+	}
+
+	case Op::SyncFull:
+		flush(FlushReason::SyncFull);
+		break;
+
+	case Op::SetColorImage:
+		set_color_image(words);
+		break;
+
+	case Op::SetMaskImage:
+		set_mask_image(words);
+		break;
+
+	case Op::SetScissor:
+		decode_scissor(scissor_state, static_state, words);
+		break;
+
+	case Op::SetOtherModes:
+		decode_other_modes(static_state, depth_blend, words);
+		break;
+
+	case Op::SetCombine:
+		decode_combine(static_state, words);
+		break;
+
+	case Op::SetTextureImage:
+		texture_image.addr = words[1] & 0x00ffffffu;
+		texture_image.width = (words[0] & 0x3ff) + 1;
+		texture_image.size = TextureSize((words[0] >> 19) & 3);
+		break;
+
+	case Op::LoadTile:
+		load_tile(UploadMode::Tile, words);
+		break;
+
+	case Op::LoadBlock:
+		load_tile(UploadMode::Block, words);
+		break;
+
+	case Op::LoadTLut:
+		load_tile(UploadMode::TLUT, words);
+		break;
+
+	default:
+		break;
+	}
+}
+
+template <typename Map>
+static std::vector<const typename Map::mapped_type *> sort_by_primitives(const Map &map)
+{
+	std::vector<const typename Map::mapped_type *> entries;
+	entries.reserve(map.size());
+	for (auto &entry : map)
+		entries.push_back(&entry.second);
+	std::sort(entries.begin(), entries.end(), [](const typename Map::mapped_type *a, const typename Map::mapped_type *b) {
+		return a->primitives > b->primitives;
+	});
+	return entries;
+}
+
+void DumpStats::report() const
+{
+	uint64_t total_commands = 0;
+	uint64_t total_primitives = 0;
+	for (unsigned i = 0; i < 64; i++)
+	{
+		total_commands += command_counts[i];
+		if (command_is_draw_call(Op(i)))
+			total_primitives += command_counts[i];
+	}
+
+	LOGI("=== Overview ===\n");
+	LOGI("  %llu frames, %llu commands, %llu primitives.\n",
+	     static_cast<unsigned long long>(frames),
+	     static_cast<unsigned long long>(total_commands),
+	     static_cast<unsigned long long>(total_primitives));
+	LOGI("  %llu RDRAM updates, %.3f MiB.\n",
+	     static_cast<unsigned long long>(rdram_updates), double(rdram_update_bytes) / (1024.0 * 1024.0));
+
+	LOGI("=== Commands ===\n");
+	for (unsigned i = 0; i < 64; i++)
+	{
+		if (!command_counts[i])
+			continue;
+		LOGI("  %16s: %10llu (%5.2f %%), %llu words.\n", command_name(Op(i)),
+		     static_cast<unsigned long long>(command_counts[i]),
+		     100.0 * double(command_counts[i]) / double(total_commands),
+		     static_cast<unsigned long long>(command_words[i]));
+	}
+
+	LOGI("=== Flushes ===\n");
+	uint64_t total_flushes = primitives_per_flush.size();
+	if (total_flushes)
+	{
+		auto sorted = primitives_per_flush;
+		std::sort(sorted.begin(), sorted.end());
+		LOGI("  %llu flushes, %.2f / frame.\n", static_cast<unsigned long long>(total_flushes),
+		     frames ? double(total_flushes) / double(frames) : 0.0);
+		LOGI("  Primitives per flush: avg %.2f, min %u, median %u, max %u.\n",
+		     double(total_primitives) / double(total_flushes),
+		     sorted.front(), sorted[sorted.size() / 2], sorted.back());
+	}
+
+	for (unsigned i = 0; i < unsigned(FlushReason::Count); i++)
+	{
+		if (!flush_counts[i])
+			continue;
+		LOGI("  %40s: %10llu flushes, %.2f primitives / flush.\n", flush_reason_name(FlushReason(i)),
+		     static_cast<unsigned long long>(flush_counts[i]),
+		     double(flush_primitives[i]) / double(flush_counts[i]));
+	}
+
+	LOGI("=== TMEM uploads ===\n");
+	for (unsigned i = 0; i < 3; i++)
+	{
+		if (!upload_counts[i])
+			continue;
+		LOGI("  %10s: %10llu uploads, %.3f MiB, %.1f bytes / upload.\n", upload_mode_name(UploadMode(i)),
+		     static_cast<unsigned long long>(upload_counts[i]),
+		     double(upload_bytes[i]) / (1024.0 * 1024.0),
+		     double(upload_bytes[i]) / double(upload_counts[i]));
+	}
+
+	LOGI("=== State ===\n");
+	LOGI("  %u distinct StaticRasterizationState, %u distinct DepthBlendState, %u distinct combinations.\n",
+	     unsigned(static_states.size()), unsigned(depth_blend_states.size()), unsigned(combined_state_hashes.size()));
+
+	auto sorted_static = sort_by_primitives(static_states);
+	for (size_t i = 0; i < std::min<size_t>(sorted_static.size(), 8); i++)
+	{
+		auto &state = sorted_static[i]->state;
+		LOGI("  Static #%u: %llu primitives, flags 0x%x, dither %u.\n", unsigned(i),
+		     static_cast<unsigned long long>(sorted_static[i]->primitives), unsigned(state.flags), state.dither);
+	}
+
+	auto sorted_depth_blend = sort_by_primitives(depth_blend_states);
+	for (size_t i = 0; i < std::min<size_t>(sorted_depth_blend.size(), 8); i++)
+	{
+		auto &state = sorted_depth_blend[i]->state;
+		LOGI("  DepthBlend #%u: %llu primitives, flags 0x%x, coverage mode %u, z mode %u.\n", unsigned(i),
+		     static_cast<unsigned long long>(sorted_depth_blend[i]->primitives), unsigned(state.flags),
+		     unsigned(state.coverage_mode), unsigned(state.z_mode));
+	}
+
+	LOGI("=== Framebuffers ===\n");
+	for (auto *entry : sort_by_primitives(framebuffers))
+	{
+		LOGI("  %8s, width %4u: set %llu times, %llu primitives.\n", fb_format_name(entry->fmt), entry->width,
+		     static_cast<unsigned long long>(entry->set_count),
+		     static_cast<unsigned long long>(entry->primitives));
+	}
+}
+
+static void print_help()
+{
+	LOGE("Usage: rdp-dump-stats\n"
+	     "\t<Path to dump>\n"
+	);
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	std::string path;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.default_handler = [&](const char *arg) { path = arg; };
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (path.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	DumpPlayer player;
+	if (!player.load_dump(path.c_str()))
+	{
+		LOGE("Failed to load dump: %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	DumpStats stats;
+	player.set_command_interface(&stats);
+	while (player.iterate())
+	{
+	}
+
+	stats.report();
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
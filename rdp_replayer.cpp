@@ -477,6 +477,29 @@ bool DebugApplication::on_key_pressed(const KeyboardEvent &e)
 			break;
 		}
 
+		case Key::Left:
+		case Key::Right:
+		{
+			unsigned target_frame = ui.replay_vi_frame_count;
+			if (e.get_key() == Key::Right)
+				target_frame += 100;
+			else
+				target_frame = target_frame > 100 ? target_frame - 100 : 0;
+
+			if (dump.seek_to_frame(target_frame))
+			{
+				ui.replay_vi_frame_count = target_frame;
+				ui.replay_draw_count_in_frame = 0;
+				for (auto &image : ui.scanout_image)
+					image.reset();
+				ui.eof = false;
+				add_message(Util::join("Seeked to frame ", target_frame, "!"), MessageType::Info);
+			}
+			else
+				add_message("Failed to seek dump!", MessageType::Error);
+			break;
+		}
+
 		case Key::P:
 		{
 			ui.paused = !ui.paused;
@@ -545,6 +568,8 @@ void DebugApplication::on_device_created(const DeviceCreatedEvent &e)
 #if 1
 	if (!dump.load_dump(dump_path.c_str()))
 		throw std::runtime_error("Failed to load RDP dump.");
+	if (!dump.build_index())
+		LOGW("Failed to index RDP dump, seeking is not available.\n");
 	replayers[0] = create_replayer_driver_angrylion(dump, *this);
 	replayers[1] = create_replayer_driver_parallel(e.get_device(), dump, *this);
 	combined_replayer = create_side_by_side_driver(replayers[0].get(), replayers[1].get(), *this);
@@ -0,0 +1,545 @@
+/* Copyright (c) 2020 Themaister
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rdp_dump.hpp"
+#include "cli_parser.hpp"
+#include "global_managers.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <vector>
+
+using namespace RDP;
+
+struct TrimOptions
+{
+	unsigned begin_frame = 0;
+	unsigned end_frame = UINT32_MAX;
+	bool dedup_frames = false;
+	bool drop_unchanged_flushes = false;
+};
+
+// Rewrites a dump through DumpWriter, which already drops RDRAM pages that do not change.
+// On top of that, frames before begin_frame are replaced with a synthesized snapshot,
+// and consecutive identical frames can be collapsed.
+class DumpTrimmer : public CommandListenerInterface
+{
+public:
+	DumpTrimmer(DumpWriter &writer_, size_t rdram_size, size_t hidden_rdram_size, const TrimOptions &options_)
+		: writer(writer_), options(options_)
+	{
+		rdram.resize(rdram_size);
+		hidden_rdram.resize(hidden_rdram_size);
+		for (auto &owner : tmem_word_owner)
+			owner = -1;
+	}
+
+	void set_vi_register(VIRegister reg, uint32_t value) override;
+	void signal_complete() override;
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+	void end_frame() override;
+	void eof() override;
+	void update_rdram(const void *data, size_t size, size_t offset) override;
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override;
+
+	bool is_done() const
+	{
+		return frame >= options.end_frame;
+	}
+
+	void report() const;
+
+private:
+	DumpWriter &writer;
+	TrimOptions options;
+
+	std::vector<uint8_t> rdram;
+	std::vector<uint8_t> hidden_rdram;
+	uint32_t vi_registers[unsigned(VIRegister::Count)] = {};
+
+	// Last state setting commands, replayed at the start of a trimmed dump.
+	uint32_t state_commands[64][2] = {};
+	bool state_command_valid[64] = {};
+	uint32_t set_tile_commands[8][2] = {};
+	uint32_t tile_size_commands[8][2] = {};
+	bool set_tile_valid[8] = {};
+	bool tile_size_valid[8] = {};
+
+	// TMEM is rebuilt by replaying the loads which still own some of it,
+	// along with the texture image and tile descriptor they used.
+	struct TMEMLoad
+	{
+		uint32_t texture_image[2];
+		uint32_t set_tile[2];
+		uint32_t load[2];
+		Op op;
+	};
+	enum { TMEMWords = 4096 / 8 };
+	std::vector<TMEMLoad> tmem_loads;
+	int tmem_word_owner[TMEMWords];
+
+	// Calls of the current frame are held back until its end, so it can be compared against the previous frame.
+	// Once a frame changes RDRAM, it can no longer be collapsed, and the rest of it is written out directly.
+	enum class CallType : uint32_t
+	{
+		SetVIRegister,
+		SignalComplete,
+		Command,
+		UpdateRDRAM,
+		UpdateHiddenRDRAM,
+		UnchangedRDRAM,
+		UnchangedHiddenRDRAM
+	};
+	std::vector<uint32_t> current_frame;
+	std::vector<uint32_t> previous_frame;
+	bool previous_frame_valid = false;
+	bool streaming = false;
+	bool started = false;
+
+	unsigned frame = 0;
+	unsigned written_frames = 0;
+	unsigned collapsed_frames = 0;
+	unsigned dropped_flushes = 0;
+
+	void track_state(Op cmd_id, const uint32_t *words);
+	void track_tmem_load(Op cmd_id, const uint32_t *words);
+	void write_snapshot();
+	void write_frame(const std::vector<uint32_t> &calls);
+	void write_call(CallType type, uint32_t arg, const uint32_t *payload, uint32_t count);
+	bool begin_call();
+	void push_call(CallType type, uint32_t arg, const uint32_t *payload, uint32_t count);
+	void update(std::vector<uint8_t> &state, bool hidden, const void *data, size_t size, size_t offset);
+};
+
+bool DumpTrimmer::begin_call()
+{
+	if (is_done() || frame < options.begin_frame)
+		return false;
+
+	if (!started)
+	{
+		started = true;
+		if (options.begin_frame != 0)
+			write_snapshot();
+	}
+
+	return true;
+}
+
+void DumpTrimmer::push_call(CallType type, uint32_t arg, const uint32_t *payload, uint32_t count)
+{
+	if (streaming)
+	{
+		write_call(type, arg, payload, count);
+		return;
+	}
+
+	current_frame.push_back(uint32_t(type));
+	current_frame.push_back(arg);
+	current_frame.push_back(count);
+	if (count)
+		current_frame.insert(current_frame.end(), payload, payload + count);
+}
+
+void DumpTrimmer::set_vi_register(VIRegister reg, uint32_t value)
+{
+	vi_registers[unsigned(reg)] = value;
+	if (begin_call())
+		push_call(CallType::SetVIRegister, uint32_t(reg), &value, 1);
+}
+
+void DumpTrimmer::signal_complete()
+{
+	if (begin_call())
+		push_call(CallType::SignalComplete, 0, nullptr, 0);
+}
+
+void DumpTrimmer::track_state(Op cmd_id, const uint32_t *words)
+{
+	unsigned tile = (words[1] >> 24) & 7;
+
+	if (cmd_id == Op::LoadTile || cmd_id == Op::LoadBlock || cmd_id == Op::LoadTLut)
+		track_tmem_load(cmd_id, words);
+
+	switch (cmd_id)
+	{
+	case Op::SetKeyGB:
+	case Op::SetKeyR:
+	case Op::SetConvert:
+	case Op::SetScissor:
+	case Op::SetPrimDepth:
+	case Op::SetOtherModes:
+	case Op::SetFillColor:
+	case Op::SetFogColor:
+	case Op::SetBlendColor:
+	case Op::SetPrimColor:
+	case Op::SetEnvColor:
+	case Op::SetCombine:
+	case Op::SetTextureImage:
+	case Op::SetMaskImage:
+	case Op::SetColorImage:
+		memcpy(state_commands[unsigned(cmd_id)], words, 2 * sizeof(uint32_t));
+		state_command_valid[unsigned(cmd_id)] = true;
+		break;
+
+	case Op::SetTile:
+		memcpy(set_tile_commands[tile], words, 2 * sizeof(uint32_t));
+		set_tile_valid[tile] = true;
+		break;
+
+	case Op::SetTileSize:
+	case Op::LoadTile:
+	case Op::LoadBlock:
+	case Op::LoadTLut:
+		// Loads update the tile size with the same encoding as SetTileSize.
+		tile_size_commands[tile][0] = (words[0] & 0x00ffffffu) | (uint32_t(Op::SetTileSize) << 24);
+		tile_size_commands[tile][1] = words[1];
+		tile_size_valid[tile] = true;
+		break;
+
+	default:
+		break;
+	}
+}
+
+void DumpTrimmer::track_tmem_load(Op cmd_id, const uint32_t *words)
+{
+	unsigned tile = (words[1] >> 24) & 7;
+	TMEMLoad load = {};
+	if (state_command_valid[unsigned(Op::SetTextureImage)])
+		memcpy(load.texture_image, state_commands[unsigned(Op::SetTextureImage)], sizeof(load.texture_image));
+	if (set_tile_valid[tile])
+		memcpy(load.set_tile, set_tile_commands[tile], sizeof(load.set_tile));
+	memcpy(load.load, words, sizeof(load.load));
+	load.op = cmd_id;
+
+	// Conservative estimate of the 64-bit TMEM words written by the load.
+	unsigned tmem_word = load.set_tile[0] & 0x1ff;
+	unsigned line = (load.set_tile[0] >> 9) & 0x1ff;
+	unsigned size = (load.texture_image[0] >> 19) & 3;
+	unsigned sl = (words[0] >> 12) & 0xfff;
+	unsigned tl = words[0] & 0xfff;
+	unsigned sh = (words[1] >> 12) & 0xfff;
+	unsigned th = words[1] & 0xfff;
+
+	unsigned count;
+	if (cmd_id == Op::LoadBlock)
+		count = (((sh - sl + 1) << size) / 2 + 7) / 8;
+	else if (cmd_id == Op::LoadTLut)
+		count = (sh >> 2) - (sl >> 2) + 1; // Every entry is replicated to a full word.
+	else
+		count = ((th >> 2) - (tl >> 2) + 1) * line;
+
+	// 32-bit texels are split between the lower and upper half of TMEM.
+	bool split = size == 3 && cmd_id != Op::LoadTLut;
+	if (count > TMEMWords || (split && count > TMEMWords / 2))
+		count = TMEMWords;
+
+	int index = int(tmem_loads.size());
+	tmem_loads.push_back(load);
+	for (unsigned i = 0; i < count; i++)
+	{
+		tmem_word_owner[(tmem_word + i) & (TMEMWords - 1)] = index;
+		if (split)
+			tmem_word_owner[(tmem_word + i + TMEMWords / 2) & (TMEMWords - 1)] = index;
+	}
+
+	// Drop loads which have been entirely overwritten.
+	if (tmem_loads.size() >= 2 * TMEMWords)
+	{
+		std::vector<int> remap(tmem_loads.size(), -1);
+		for (auto owner : tmem_word_owner)
+			if (owner >= 0)
+				remap[owner] = 0;
+
+		std::vector<TMEMLoad> live_loads;
+		for (size_t i = 0; i < tmem_loads.size(); i++)
+		{
+			if (remap[i] == 0)
+			{
+				remap[i] = int(live_loads.size());
+				live_loads.push_back(tmem_loads[i]);
+			}
+		}
+
+		for (auto &owner : tmem_word_owner)
+			if (owner >= 0)
+				owner = remap[owner];
+		tmem_loads = std::move(live_loads);
+	}
+}
+
+void DumpTrimmer::command(Op cmd_id, uint32_t num_words, const uint32_t *words)
+{
+	track_state(cmd_id, words);
+	if (begin_call())
+		push_call(CallType::Command, uint32_t(cmd_id), words, num_words);
+}
+
+void DumpTrimmer::update(std::vector<uint8_t> &state, bool hidden, const void *data, size_t size, size_t offset)
+{
+	if (offset + size > state.size())
+		return;
+
+	bool changed = memcmp(state.data() + offset, data, size) != 0;
+	if (!begin_call())
+	{
+		if (changed)
+			memcpy(state.data() + offset, data, size);
+		return;
+	}
+
+	if (changed)
+	{
+		// Held back calls refer to the RDRAM contents before this update.
+		if (!streaming)
+		{
+			write_frame(current_frame);
+			current_frame.clear();
+			streaming = true;
+		}
+
+		memcpy(state.data() + offset, data, size);
+		const uint32_t args[] = { uint32_t(offset), uint32_t(size) };
+		push_call(hidden ? CallType::UpdateHiddenRDRAM : CallType::UpdateRDRAM, 0, args, 2);
+	}
+	else if (options.drop_unchanged_flushes)
+		dropped_flushes++;
+	else
+	{
+		const uint32_t args[] = { uint32_t(offset), uint32_t(size) };
+		push_call(hidden ? CallType::UnchangedHiddenRDRAM : CallType::UnchangedRDRAM, 0, args, 2);
+	}
+}
+
+void DumpTrimmer::update_rdram(const void *data, size_t size, size_t offset)
+{
+	update(rdram, false, data, size, offset);
+}
+
+void DumpTrimmer::update_hidden_rdram(const void *data, size_t size, size_t offset)
+{
+	update(hidden_rdram, true, data, size, offset);
+}
+
+void DumpTrimmer::write_snapshot()
+{
+	for (unsigned i = 0; i < unsigned(VIRegister::Count); i++)
+		writer.set_vi_register(VIRegister(i), vi_registers[i]);
+
+	writer.update_rdram(rdram.data(), rdram.size(), 0);
+	writer.update_hidden_rdram(hidden_rdram.data(), hidden_rdram.size(), 0);
+
+	// Loads read from RDRAM as it is at begin_frame, not as it was when they originally ran.
+	std::vector<bool> live(tmem_loads.size());
+	for (auto owner : tmem_word_owner)
+		if (owner >= 0)
+			live[owner] = true;
+
+	for (size_t i = 0; i < tmem_loads.size(); i++)
+	{
+		if (!live[i])
+			continue;
+		auto &load = tmem_loads[i];
+		writer.command(Op::SetTextureImage, 2, load.texture_image);
+		writer.command(Op::SetTile, 2, load.set_tile);
+		writer.command(load.op, 2, load.load);
+	}
+
+	for (unsigned i = 0; i < 64; i++)
+		if (state_command_valid[i])
+			writer.command(Op(i), 2, state_commands[i]);
+	for (unsigned i = 0; i < 8; i++)
+		if (set_tile_valid[i])
+			writer.command(Op::SetTile, 2, set_tile_commands[i]);
+	for (unsigned i = 0; i < 8; i++)
+		if (tile_size_valid[i])
+			writer.command(Op::SetTileSize, 2, tile_size_commands[i]);
+}
+
+void DumpTrimmer::write_call(CallType type, uint32_t arg, const uint32_t *payload, uint32_t count)
+{
+	switch (type)
+	{
+	case CallType::SetVIRegister:
+		writer.set_vi_register(VIRegister(arg), payload[0]);
+		break;
+
+	case CallType::SignalComplete:
+		writer.signal_complete();
+		break;
+
+	case CallType::Command:
+		writer.command(Op(arg), count, payload);
+		break;
+
+	case CallType::UpdateRDRAM:
+	case CallType::UnchangedRDRAM:
+		writer.update_rdram(rdram.data() + payload[0], payload[1], payload[0]);
+		break;
+
+	case CallType::UpdateHiddenRDRAM:
+	case CallType::UnchangedHiddenRDRAM:
+		writer.update_hidden_rdram(hidden_rdram.data() + payload[0], payload[1], payload[0]);
+		break;
+	}
+}
+
+void DumpTrimmer::write_frame(const std::vector<uint32_t> &calls)
+{
+	size_t offset = 0;
+	while (offset < calls.size())
+	{
+		uint32_t count = calls[offset + 2];
+		write_call(CallType(calls[offset]), calls[offset + 1], calls.data() + offset + 3, count);
+		offset += 3 + count;
+	}
+}
+
+void DumpTrimmer::end_frame()
+{
+	if (begin_call())
+	{
+		if (streaming)
+		{
+			writer.end_frame();
+			written_frames++;
+			previous_frame_valid = false;
+			streaming = false;
+		}
+		else if (options.dedup_frames && previous_frame_valid && current_frame == previous_frame)
+			collapsed_frames++;
+		else
+		{
+			write_frame(current_frame);
+			writer.end_frame();
+			written_frames++;
+			std::swap(previous_frame, current_frame);
+			previous_frame_valid = true;
+		}
+
+		current_frame.clear();
+	}
+
+	frame++;
+}
+
+void DumpTrimmer::eof()
+{
+	if (started && !streaming)
+		write_frame(current_frame);
+	current_frame.clear();
+	streaming = false;
+	writer.eof();
+}
+
+void DumpTrimmer::report() const
+{
+	LOGI("Wrote %u frames, collapsed %u identical frames, dropped %u unchanged RDRAM flushes.\n",
+	     written_frames, collapsed_frames, dropped_flushes);
+}
+
+static void print_help()
+{
+	LOGE("Usage: rdp-trim-dump\n"
+	     "\t<Path to dump>\n"
+	     "\t--output <Path to trimmed dump>\n"
+	     "\t[--begin-frame <frame>] (TMEM is rebuilt by replaying loads against RDRAM at this frame)\n"
+	     "\t[--end-frame <frame>]\n"
+	     "\t[--dedup-frames]\n"
+	     "\t[--drop-unchanged-flushes]\n"
+	     "\t[--rdpdump2]\n"
+	);
+}
+
+static int main_inner(int argc, char *argv[])
+{
+	std::string path;
+	std::string output_path;
+	TrimOptions options;
+	DumpFormat format = DumpFormat::RDPDump3;
+
+	Util::CLICallbacks cbs;
+	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output", [&](Util::CLIParser &parser) { output_path = parser.next_string(); });
+	cbs.add("--begin-frame", [&](Util::CLIParser &parser) { options.begin_frame = parser.next_uint(); });
+	cbs.add("--end-frame", [&](Util::CLIParser &parser) { options.end_frame = parser.next_uint(); });
+	cbs.add("--dedup-frames", [&](Util::CLIParser &) { options.dedup_frames = true; });
+	cbs.add("--drop-unchanged-flushes", [&](Util::CLIParser &) { options.drop_unchanged_flushes = true; });
+	cbs.add("--rdpdump2", [&](Util::CLIParser &) { format = DumpFormat::RDPDump2; });
+	cbs.default_handler = [&](const char *arg) { path = arg; };
+	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+
+	if (!parser.parse())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+	else if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (path.empty() || output_path.empty() || options.begin_frame >= options.end_frame)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	DumpPlayer player;
+	if (!player.load_dump(path.c_str()))
+	{
+		LOGE("Failed to load dump: %s\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	DumpWriter writer;
+	if (!writer.open(output_path.c_str(), player.get_rdram_size(), player.get_hidden_rdram_size(), format))
+	{
+		LOGE("Failed to open %s for writing.\n", output_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	DumpTrimmer trimmer(writer, player.get_rdram_size(), player.get_hidden_rdram_size(), options);
+	player.set_command_interface(&trimmer);
+	while (!trimmer.is_done() && player.iterate())
+	{
+	}
+
+	// The dump ran out, or the end frame was reached.
+	if (trimmer.is_done())
+		trimmer.eof();
+
+	if (!writer.close())
+	{
+		LOGE("Failed to write %s.\n", output_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	trimmer.report();
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	Granite::Global::init();
+	int ret = main_inner(argc, argv);
+	Granite::Global::deinit();
+	return ret;
+}
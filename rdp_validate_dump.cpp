@@ -33,22 +33,64 @@ static void print_help()
 	LOGE("Usage: rdp-validate-dump\n"
 	     "\t<Path to dump>\n"
 	     "\t[--begin-frame <frame>]\n"
+	     "\t[--seek]\n"
 	     "\t[--sync-only]\n"
+	     "\t[--threaded]\n"
+	     "\t[--written-ranges-only]\n"
+	     "\t[--bisect]\n"
 	);
 }
 
+// Seeks to start_frame, or rewinds the dump if zero.
+static bool seek_to_start(ReplayerState &state, DumpPlayer &player, unsigned start_frame)
+{
+	auto &iface = state.iface;
+	if (start_frame ? !player.seek_to_frame(start_frame) : !player.rewind())
+		return false;
+
+	iface.reset_counters();
+	iface.frame_count_for_context[0] = start_frame;
+	iface.frame_count_for_context[1] = start_frame;
+	return true;
+}
+
+// Replays the dump from start_frame without validation until frame_count frames have been scanned out.
+static bool rewind_to_frame(ReplayerState &state, DumpPlayer &player, unsigned start_frame, unsigned frame_count)
+{
+	auto &iface = state.iface;
+	state.combined->idle();
+	if (!seek_to_start(state, player, start_frame))
+		return false;
+
+	while (iface.frame_count_for_context[1] < frame_count && player.iterate())
+	{
+	}
+
+	state.combined->idle();
+	iface.clear_written_rdram_ranges();
+	return iface.frame_count_for_context[1] == frame_count;
+}
+
 static int main_inner(int argc, char *argv[])
 {
 	std::string path;
 	unsigned begin_frame = 0;
+	bool seek = false;
 	bool sync_only = false;
 	bool capture = false;
+	bool threaded = false;
+	bool written_ranges_only = false;
+	bool bisect = false;
 
 	Util::CLICallbacks cbs;
 	cbs.add("--help", [](Util::CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--begin-frame", [&](Util::CLIParser &parser) { begin_frame = parser.next_uint(); });
+	cbs.add("--seek", [&](Util::CLIParser &) { seek = true; });
 	cbs.add("--sync-only", [&](Util::CLIParser &) { sync_only = true; });
 	cbs.add("--capture", [&](Util::CLIParser &) { capture = true; });
+	cbs.add("--threaded", [&](Util::CLIParser &) { threaded = true; });
+	cbs.add("--written-ranges-only", [&](Util::CLIParser &) { written_ranges_only = true; });
+	cbs.add("--bisect", [&](Util::CLIParser &) { bisect = true; });
 	cbs.default_handler = [&](const char *arg) { path = arg; };
 	Util::CLIParser parser(std::move(cbs), argc - 1, argv + 1);
 
@@ -72,7 +114,7 @@ static int main_inner(int argc, char *argv[])
 	}
 
 	ReplayerState state;
-	if (!state.init(player))
+	if (!state.init(player, threaded))
 	{
 		LOGE("Failed to initialize Vulkan device.\n");
 		return EXIT_FAILURE;
@@ -80,6 +122,26 @@ static int main_inner(int argc, char *argv[])
 
 	auto &iface = state.iface;
 
+	// By default, frames before begin_frame are replayed through both drivers without validation,
+	// so they reach begin_frame with the RDP state and TMEM set up by the earlier frames.
+	// With --seek, the dump skips straight to begin_frame instead. Only the dump's RDRAM is restored then,
+	// so the drivers start out from reset RDP state and TMEM.
+	unsigned start_frame = seek ? begin_frame : 0;
+	if (start_frame && (!player.build_index() || !seek_to_start(state, player, start_frame)))
+	{
+		LOGE("Failed to seek to frame %u.\n", start_frame);
+		return EXIT_FAILURE;
+	}
+
+	RDRAMCompareState compare_state;
+	bool tmem_nonzero = false;
+	unsigned last_full_compare_frame = ~0u;
+
+	// With --bisect, validate once per frame until a frame fails,
+	// then replay the dump up to that frame and validate it draw by draw.
+	bool frame_granularity = bisect;
+	unsigned validated_frames = start_frame;
+
 	while (!state.iface.is_eof)
 	{
 		if (capture)
@@ -89,24 +151,75 @@ static int main_inner(int argc, char *argv[])
 		unsigned current_frame_count = iface.frame_count_for_context[1];
 		unsigned current_syncs = iface.syncs_for_context[1];
 		while (current_frame_count == iface.frame_count_for_context[1] &&
-		       ((!sync_only && current_draw_count == iface.draw_calls_for_context[1]) ||
+		       (frame_granularity ||
+		        (!sync_only && current_draw_count == iface.draw_calls_for_context[1]) ||
 		        (sync_only && current_syncs == iface.syncs_for_context[1])) &&
 		       player.iterate())
 		{
 		}
 
+		// Join the reference driver before inspecting its state.
+		state.combined->idle();
+
 		if (capture)
 			state.device.end_renderdoc_capture();
 
-		uint32_t fault_addr;
-		bool fault_hidden;
+		uint32_t fault_addr = 0;
+		bool fault_hidden = false;
 
 		current_draw_count = iface.draw_calls_for_context[1];
 		current_frame_count = iface.frame_count_for_context[1];
 		current_syncs = iface.syncs_for_context[1];
 
-		if (current_frame_count >= begin_frame &&
-		    !compare_memory("TMEM", state.reference->get_tmem(), state.gpu->get_tmem(), 4096, &fault_addr))
+		bool tmem_equal = current_frame_count < begin_frame ||
+		                  compare_memory("TMEM", state.reference->get_tmem(), state.gpu->get_tmem(), 4096, &fault_addr,
+		                                 &tmem_nonzero);
+
+		// Written ranges are tracked for the device under test, which the reference context has caught up with here.
+		// With --written-ranges-only, all of RDRAM is still compared once per frame,
+		// which catches writes outside the tracked ranges with some delay.
+		bool too_many_ranges = iface.all_rdram_written_for_context[1];
+		bool full_compare = !written_ranges_only || too_many_ranges ||
+		                    current_frame_count != last_full_compare_frame;
+
+		// Only worth mentioning if the range compare would otherwise have been used.
+		if (written_ranges_only && too_many_ranges && current_frame_count == last_full_compare_frame &&
+		    tmem_equal && current_frame_count >= begin_frame)
+		{
+			LOGI("More than %u RDRAM ranges written in frame %u, draw %u, falling back to full RDRAM compare.\n",
+			     unsigned(Interface::MaxWrittenRDRAMRanges), current_frame_count, current_draw_count);
+		}
+
+		bool rdram_equal;
+		if (!tmem_equal || current_frame_count < begin_frame)
+			rdram_equal = true;
+		else if (full_compare)
+		{
+			rdram_equal = compare_rdram(*state.reference, *state.gpu, &fault_addr, &fault_hidden, &compare_state);
+			last_full_compare_frame = current_frame_count;
+		}
+		else
+		{
+			rdram_equal = compare_rdram_ranges(*state.reference, *state.gpu, iface.written_rdram_ranges_for_context[1],
+			                                   &fault_addr, &fault_hidden);
+		}
+		iface.clear_written_rdram_ranges();
+
+		if (frame_granularity && (!tmem_equal || !rdram_equal))
+		{
+			LOGI("Divergence in frame %u, replaying it draw by draw.\n", validated_frames);
+			if (!rewind_to_frame(state, player, start_frame, validated_frames))
+			{
+				LOGE("Failed to rewind dump.\n");
+				return EXIT_FAILURE;
+			}
+
+			last_full_compare_frame = ~0u;
+			frame_granularity = false;
+			continue;
+		}
+
+		if (!tmem_equal)
 		{
 			if (sync_only)
 			{
@@ -121,8 +234,7 @@ static int main_inner(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
-		if (current_frame_count >= begin_frame &&
-		    !compare_rdram(*state.reference, *state.gpu, &fault_addr, &fault_hidden))
+		if (!rdram_equal)
 		{
 			if (sync_only)
 			{
@@ -138,14 +250,15 @@ static int main_inner(int argc, char *argv[])
 			if (fault_hidden)
 				fault_addr *= 2;
 
-			if (state.iface.fb.width)
+			auto &fb = iface.fb_for_context[1];
+			if (fb.width)
 			{
 				int color_x, color_y, depth_x, depth_y;
-				int color_offset = int(fault_addr - state.iface.fb.addr);
-				int depth_offset = int(fault_addr - state.iface.fb.depth_addr);
+				int color_offset = int(fault_addr - fb.addr);
+				int depth_offset = int(fault_addr - fb.depth_addr);
 				depth_offset >>= 1;
 
-				switch (state.iface.fb.size)
+				switch (fb.size)
 				{
 				case 2:
 					color_offset >>= 1;
@@ -159,10 +272,10 @@ static int main_inner(int argc, char *argv[])
 					break;
 				}
 
-				color_x = color_offset % state.iface.fb.width;
-				color_y = color_offset / state.iface.fb.width;
-				depth_x = depth_offset % state.iface.fb.width;
-				depth_y = depth_offset / state.iface.fb.width;
+				color_x = color_offset % fb.width;
+				color_y = color_offset / fb.width;
+				depth_x = depth_offset % fb.width;
+				depth_y = depth_offset / fb.width;
 
 				if ((color_offset <= depth_offset || depth_offset < 0) && color_offset >= 0)
 				{
@@ -187,7 +300,18 @@ static int main_inner(int argc, char *argv[])
 
 		state.device.next_frame_context();
 
-		if (current_frame_count >= begin_frame)
+		if (frame_granularity)
+		{
+			validated_frames++;
+			if (current_frame_count >= begin_frame)
+				LOGI("Passed frame %u.\n", current_frame_count);
+		}
+		else if (bisect && current_frame_count > validated_frames)
+		{
+			LOGE("Divergence in frame %u did not reproduce when replayed draw by draw.\n", validated_frames);
+			return EXIT_FAILURE;
+		}
+		else if (current_frame_count >= begin_frame)
 		{
 			if (sync_only)
 				LOGI("Passed frame %u, sync %u.\n", current_frame_count, current_syncs);
@@ -21,6 +21,10 @@
  */
 
 #include "replayer_driver.hpp"
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <string.h>
 
 namespace RDP
 {
@@ -136,4 +140,333 @@ std::unique_ptr<ReplayerDriver> create_side_by_side_driver(ReplayerDriver *first
 {
 	return std::make_unique<SideBySideDriver>(first, second, iface);
 }
+
+// Runs the first driver on a worker thread, fed from a queue of recorded calls,
+// while the second driver runs on the calling thread.
+// Both are joined in idle() and end_frame(), which is where results are compared.
+struct ThreadedSideBySideDriver : ReplayerDriver
+{
+	ThreadedSideBySideDriver(ReplayerDriver *first_, ReplayerDriver *second_)
+		: first(first_), second(second_)
+	{
+		worker = std::thread(&ThreadedSideBySideDriver::worker_loop, this);
+	}
+
+	~ThreadedSideBySideDriver() override;
+
+	uint8_t *get_rdram() override
+	{
+		return nullptr;
+	}
+
+	size_t get_rdram_size() override
+	{
+		return 0;
+	}
+
+	uint8_t *get_hidden_rdram() override
+	{
+		return nullptr;
+	}
+
+	size_t get_hidden_rdram_size() override
+	{
+		return 0;
+	}
+
+	uint8_t *get_tmem() override
+	{
+		return nullptr;
+	}
+
+	void idle() override;
+	void set_vi_register(VIRegister index, uint32_t value) override;
+	void signal_complete() override;
+	void command(Op cmd_id, uint32_t num_words, const uint32_t *words) override;
+	void end_frame() override;
+	void eof() override;
+	void update_rdram(const void *data, size_t size, size_t offset) override;
+	void update_hidden_rdram(const void *data, size_t size, size_t offset) override;
+
+	enum class CallType
+	{
+		SetVIRegister,
+		SignalComplete,
+		Command,
+		EndFrame,
+		EndOfFile,
+		UpdateRDRAM,
+		UpdateHiddenRDRAM
+	};
+
+	struct Call
+	{
+		CallType type;
+		uint32_t arg;
+		size_t offset;
+		size_t size;
+		size_t payload_offset;
+	};
+
+	struct Batch
+	{
+		std::vector<Call> calls;
+		std::vector<uint32_t> payload;
+	};
+
+	enum { MaxCallsPerBatch = 1024 };
+
+	ReplayerDriver *first;
+	ReplayerDriver *second;
+
+	Batch current;
+	std::deque<Batch> queue;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::condition_variable idle_cond;
+	std::thread worker;
+	bool worker_busy = false;
+	bool dead = false;
+
+	void push_call(CallType type, uint32_t arg, const void *data, size_t size, size_t offset);
+	void submit_batch();
+	void wait_worker_idle();
+	void execute(const Batch &batch);
+	void worker_loop();
+};
+
+ThreadedSideBySideDriver::~ThreadedSideBySideDriver()
+{
+	submit_batch();
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		dead = true;
+	}
+	cond.notify_one();
+	if (worker.joinable())
+		worker.join();
+}
+
+void ThreadedSideBySideDriver::push_call(CallType type, uint32_t arg, const void *data, size_t size, size_t offset)
+{
+	Call call = {};
+	call.type = type;
+	call.arg = arg;
+	call.offset = offset;
+	call.size = size;
+	call.payload_offset = current.payload.size();
+
+	if (size)
+	{
+		current.payload.resize(current.payload.size() + (size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+		memcpy(current.payload.data() + call.payload_offset, data, size);
+	}
+
+	current.calls.push_back(call);
+	if (current.calls.size() >= MaxCallsPerBatch)
+		submit_batch();
+}
+
+void ThreadedSideBySideDriver::submit_batch()
+{
+	if (current.calls.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		queue.push_back(std::move(current));
+	}
+	cond.notify_one();
+	current = {};
+}
+
+void ThreadedSideBySideDriver::wait_worker_idle()
+{
+	submit_batch();
+	std::unique_lock<std::mutex> holder{lock};
+	idle_cond.wait(holder, [this]() {
+		return queue.empty() && !worker_busy;
+	});
+}
+
+void ThreadedSideBySideDriver::execute(const Batch &batch)
+{
+	for (auto &call : batch.calls)
+	{
+		auto *payload = batch.payload.data() + call.payload_offset;
+
+		switch (call.type)
+		{
+		case CallType::SetVIRegister:
+			first->set_vi_register(VIRegister(call.offset), call.arg);
+			break;
+
+		case CallType::SignalComplete:
+			first->signal_complete();
+			break;
+
+		case CallType::Command:
+			first->command(Op(call.arg), uint32_t(call.size / sizeof(uint32_t)), payload);
+			break;
+
+		case CallType::EndFrame:
+			first->end_frame();
+			break;
+
+		case CallType::EndOfFile:
+			first->eof();
+			break;
+
+		case CallType::UpdateRDRAM:
+			first->update_rdram(payload, call.size, call.offset);
+			break;
+
+		case CallType::UpdateHiddenRDRAM:
+			first->update_hidden_rdram(payload, call.size, call.offset);
+			break;
+		}
+	}
+}
+
+void ThreadedSideBySideDriver::worker_loop()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	for (;;)
+	{
+		cond.wait(holder, [this]() {
+			return !queue.empty() || dead;
+		});
+
+		if (queue.empty())
+			break;
+
+		Batch batch = std::move(queue.front());
+		queue.pop_front();
+		worker_busy = true;
+		holder.unlock();
+
+		execute(batch);
+
+		holder.lock();
+		worker_busy = false;
+		if (queue.empty())
+			idle_cond.notify_all();
+	}
+}
+
+void ThreadedSideBySideDriver::idle()
+{
+	second->idle();
+	wait_worker_idle();
+	first->idle();
+}
+
+void ThreadedSideBySideDriver::set_vi_register(VIRegister index, uint32_t value)
+{
+	push_call(CallType::SetVIRegister, value, nullptr, 0, size_t(index));
+	second->set_vi_register(index, value);
+}
+
+void ThreadedSideBySideDriver::signal_complete()
+{
+	push_call(CallType::SignalComplete, 0, nullptr, 0, 0);
+	second->signal_complete();
+}
+
+void ThreadedSideBySideDriver::command(Op cmd_id, uint32_t num_words, const uint32_t *words)
+{
+	push_call(CallType::Command, uint32_t(cmd_id), words, num_words * sizeof(uint32_t), 0);
+	second->command(cmd_id, num_words, words);
+}
+
+void ThreadedSideBySideDriver::end_frame()
+{
+	push_call(CallType::EndFrame, 0, nullptr, 0, 0);
+	submit_batch();
+	second->end_frame();
+	wait_worker_idle();
+}
+
+void ThreadedSideBySideDriver::eof()
+{
+	push_call(CallType::EndOfFile, 0, nullptr, 0, 0);
+	submit_batch();
+	second->eof();
+}
+
+void ThreadedSideBySideDriver::update_rdram(const void *data, size_t size, size_t offset)
+{
+	push_call(CallType::UpdateRDRAM, 0, data, size, offset);
+	second->update_rdram(data, size, offset);
+}
+
+void ThreadedSideBySideDriver::update_hidden_rdram(const void *data, size_t size, size_t offset)
+{
+	push_call(CallType::UpdateHiddenRDRAM, 0, data, size, offset);
+	second->update_hidden_rdram(data, size, offset);
+}
+
+std::unique_ptr<ReplayerDriver> create_threaded_side_by_side_driver(ReplayerDriver *first, ReplayerDriver *second)
+{
+	return std::make_unique<ThreadedSideBySideDriver>(first, second);
+}
+
+// Delivers events for one context, serialized against other contexts through a shared lock.
+struct SynchronizedEventInterface : ReplayerEventInterface
+{
+	SynchronizedEventInterface(ReplayerEventInterface &iface_, unsigned context_index_, std::mutex &lock_)
+		: iface(iface_), context_index(context_index_), lock(lock_)
+	{
+	}
+
+	void update_screen(const void *data, unsigned width, unsigned height, unsigned row_length) override
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		iface.set_context_index(context_index);
+		iface.update_screen(data, width, height, row_length);
+	}
+
+	void notify_command(Op cmd_id, uint32_t num_words, const uint32_t *words) override
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		iface.set_context_index(context_index);
+		iface.notify_command(cmd_id, num_words, words);
+	}
+
+	void message(MessageType type, const char *msg) override
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		iface.set_context_index(context_index);
+		iface.message(type, msg);
+	}
+
+	void eof() override
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		iface.set_context_index(context_index);
+		iface.eof();
+	}
+
+	void set_context_index(unsigned) override
+	{
+	}
+
+	void signal_complete() override
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		iface.set_context_index(context_index);
+		iface.signal_complete();
+	}
+
+	ReplayerEventInterface &iface;
+	unsigned context_index;
+	std::mutex &lock;
+};
+
+std::unique_ptr<ReplayerEventInterface> create_synchronized_event_interface(ReplayerEventInterface &iface,
+                                                                            unsigned context_index,
+                                                                            std::mutex &lock)
+{
+	return std::make_unique<SynchronizedEventInterface>(iface, context_index, lock);
+}
 }
\ No newline at end of file
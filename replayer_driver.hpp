@@ -24,6 +24,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include "rdp_dump.hpp"
 
 namespace Vulkan
@@ -97,6 +98,7 @@ static inline bool command_is_draw_call(Op cmd_id)
 
 struct ReplayerEventInterface
 {
+	virtual ~ReplayerEventInterface() = default;
 	virtual void update_screen(const void *data, unsigned width, unsigned height, unsigned row_length) = 0;
 	virtual void notify_command(Op cmd_id, uint32_t num_words, const uint32_t *words) = 0;
 	virtual void message(MessageType type, const char *msg) = 0;
@@ -105,7 +107,27 @@ struct ReplayerEventInterface
 	virtual void signal_complete() = 0;
 };
 
-std::unique_ptr<ReplayerDriver> create_replayer_driver_angrylion(CommandInterface &player, ReplayerEventInterface &iface);
+struct AngrylionConfig
+{
+	// Uses Angrylion's multithreaded renderer, where every worker renders an interleaved subset of scanlines.
+	bool parallel = false;
+	// 0 picks one worker per hardware thread.
+	unsigned num_workers = 0;
+	// Hands out scanlines to workers in bands of this many lines rather than one by one.
+	// Workers skip primitives which do not touch any of their bands. 0 keeps the interleaved split.
+	unsigned band_lines = 0;
+};
+
+std::unique_ptr<ReplayerDriver> create_replayer_driver_angrylion(CommandInterface &player, ReplayerEventInterface &iface,
+                                                                 const AngrylionConfig &config = {});
 std::unique_ptr<ReplayerDriver> create_replayer_driver_parallel(Vulkan::Device &device, CommandInterface &player, ReplayerEventInterface &iface);
 std::unique_ptr<ReplayerDriver> create_side_by_side_driver(ReplayerDriver *first, ReplayerDriver *second, ReplayerEventInterface &iface);
+
+// The first driver runs on a worker thread, and is only synchronized with in idle() and end_frame().
+// Since both drivers deliver events concurrently, each driver should be created with its own
+// event interface from create_synchronized_event_interface().
+std::unique_ptr<ReplayerDriver> create_threaded_side_by_side_driver(ReplayerDriver *first, ReplayerDriver *second);
+std::unique_ptr<ReplayerEventInterface> create_synchronized_event_interface(ReplayerEventInterface &iface,
+                                                                            unsigned context_index,
+                                                                            std::mutex &lock);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ extern "C" {
 #include "n64video.h"
 #include "vdac.h"
 #include "msg.h"
+#include "parallel.h"
 void rdp_cmd(uint32_t wid, const uint32_t* args);
 // HACK: Poke into hidden RDRAM.
 extern uint8_t rdram_hidden[RDRAM_MAX_SIZE / 2];
@@ -35,6 +36,7 @@ extern uint8_t *get_tmem(void);
 #include "rdp_common.hpp"
 #include <string.h>
 #include <stdarg.h>
+#include <vector>
 
 static n64video_config config = {};
 
@@ -44,7 +46,7 @@ namespace RDP
 class AngrylionReplayer : public ReplayerDriver
 {
 public:
-	AngrylionReplayer(CommandInterface &player_, ReplayerEventInterface &iface);
+	AngrylionReplayer(CommandInterface &player_, ReplayerEventInterface &iface, const AngrylionConfig &config);
 
 	~AngrylionReplayer() override;
 
@@ -52,6 +54,8 @@ public:
 
 	void message(MessageType type, const char *msg);
 
+	void run_buffered_commands(uint32_t worker_id);
+
 	uint8_t *get_rdram() override
 	{
 		return rdram.data();
@@ -79,6 +83,7 @@ public:
 
 	void idle() override
 	{
+		flush_commands();
 	}
 
 private:
@@ -92,6 +97,13 @@ private:
 	uint32_t *p_vi_regs[VI_NUM_REG] = {};
 	uint32_t *p_dp_regs[DP_NUM_REG] = {};
 
+	// In parallel mode, commands are batched up and replayed by every worker,
+	// like n64video_process_list() does.
+	bool parallel = false;
+	std::vector<uint32_t> buffered_words;
+	std::vector<uint32_t> buffered_offsets;
+	void flush_commands();
+
 	void eof() override;
 	void signal_complete() override;
 	void update_rdram(const void *data, size_t size, size_t offset) override;
@@ -167,32 +179,88 @@ void AngrylionReplayer::message(MessageType type, const char *msg)
 
 void AngrylionReplayer::eof()
 {
+	flush_commands();
 	iface.eof();
 }
 
 void AngrylionReplayer::signal_complete()
 {
+	flush_commands();
 	iface.signal_complete();
 }
 
 void AngrylionReplayer::update_rdram(const void *data, size_t size, size_t offset)
 {
+	flush_commands();
 	memcpy(rdram.data() + offset, data, size);
 }
 
 void AngrylionReplayer::update_hidden_rdram(const void *data, size_t size, size_t offset)
 {
+	flush_commands();
 	memcpy(rdram_hidden + offset, data, size);
 }
 
+static void run_buffered_commands(uint32_t worker_id)
+{
+	global_replayer->run_buffered_commands(worker_id);
+}
+
+void AngrylionReplayer::run_buffered_commands(uint32_t worker_id)
+{
+	for (auto offset : buffered_offsets)
+		rdp_cmd(worker_id, buffered_words.data() + offset);
+}
+
+void AngrylionReplayer::flush_commands()
+{
+	if (buffered_offsets.empty())
+		return;
+
+	parallel_run(RDP::run_buffered_commands);
+	buffered_words.clear();
+	buffered_offsets.clear();
+}
+
+static bool command_needs_flush(Op command_id)
+{
+	// Matches the DP_COMPAT_HIGH sync table in n64video.c.
+	switch (command_id)
+	{
+	case Op::SetTextureImage:
+	case Op::SetMaskImage:
+	case Op::SetColorImage:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 void AngrylionReplayer::command(Op command_id, uint32_t num_words, const uint32_t *words)
 {
-	rdp_cmd(0, words);
+	if (!parallel)
+		rdp_cmd(0, words);
+	else if (command_id == Op::SyncFull)
+	{
+		// SyncFull must run on the main thread only.
+		flush_commands();
+		rdp_cmd(0, words);
+	}
+	else
+	{
+		buffered_offsets.push_back(uint32_t(buffered_words.size()));
+		buffered_words.insert(buffered_words.end(), words, words + num_words);
+		if (buffered_offsets.size() >= 1024 || command_needs_flush(command_id))
+			flush_commands();
+	}
+
 	iface.notify_command(command_id, num_words, words);
 }
 
 void AngrylionReplayer::end_frame()
 {
+	flush_commands();
 	n64video_update_screen();
 }
 
@@ -202,8 +270,9 @@ void AngrylionReplayer::set_vi_register(VIRegister index, uint32_t value)
 	//LOGI("Setting VI register %u -> %u.\n", index, value);
 }
 
-AngrylionReplayer::AngrylionReplayer(CommandInterface &player_, ReplayerEventInterface &iface_)
-	: player(player_), iface(iface_)
+AngrylionReplayer::AngrylionReplayer(CommandInterface &player_, ReplayerEventInterface &iface_,
+                                     const AngrylionConfig &angrylion_config)
+	: player(player_), iface(iface_), parallel(angrylion_config.parallel)
 {
 	rdram.resize(player.get_rdram_size());
 	for (unsigned i = 0; i < VI_NUM_REG; i++)
@@ -220,6 +289,9 @@ AngrylionReplayer::AngrylionReplayer(CommandInterface &player_, ReplayerEventInt
 	config.vi.mode = VI_MODE_NORMAL;
 	config.vi.interp = VI_INTERP_LINEAR;
 	config.dp.compat = DP_COMPAT_HIGH;
+	config.dp.band_lines = angrylion_config.band_lines;
+	config.parallel = angrylion_config.parallel;
+	config.num_workers = angrylion_config.num_workers;
 	n64video_init(&config);
 }
 
@@ -228,7 +300,8 @@ AngrylionReplayer::~AngrylionReplayer()
 	n64video_close();
 }
 
-std::unique_ptr<ReplayerDriver> create_replayer_driver_angrylion(CommandInterface &player, ReplayerEventInterface &iface)
+std::unique_ptr<ReplayerDriver> create_replayer_driver_angrylion(CommandInterface &player, ReplayerEventInterface &iface,
+                                                                 const AngrylionConfig &config)
 {
 	if (global_replayer)
 	{
@@ -236,7 +309,7 @@ std::unique_ptr<ReplayerDriver> create_replayer_driver_angrylion(CommandInterfac
 		return nullptr;
 	}
 
-	auto ret = std::make_unique<AngrylionReplayer>(player, iface);
+	auto ret = std::make_unique<AngrylionReplayer>(player, iface, config);
 	global_replayer = ret.get();
 	return ret;
 }